@@ -0,0 +1,566 @@
+/**
+ * tMbench.c - Checks and benchmarks for terminalMIDI's optimisations
+ *
+ * Build: clang -O2 tMwavegen.c -o tMwavegen && ./tMwavegen > tMwavetables.h
+ *        clang -O2 -framework AudioToolbox -framework CoreMIDI -framework ApplicationServices -framework CoreFoundation tMbench.c -o tMbench
+ * Run:   ./tMbench [section...]   (no argument runs every section)
+ *
+ * terminalMIDI.c is compiled in whole with its main renamed, so every section
+ * measures the engine's own code rather than a copy of it. Each section
+ * prints the figures quoted when its optimisation went in and fails (exit
+ * status 1) if its correctness check does not hold. Timings are best-of-N
+ * (voices per core counts thread CPU time); run on an idle machine.
+ */
+
+#include <sys/wait.h>
+
+#define main terminalmidi_main
+#include "terminalMIDI.c"
+#undef main
+
+static double now_us(void) {
+    return mach_to_nanos(mach_absolute_time()) / 1e3;
+}
+
+// CPU time of the calling thread - immune to preemption, for per-core figures
+static double thread_cpu_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Clock drift - the loop-start accumulator against exact arithmetic over a
+// 10-hour session, the tempo table round trip, and the tick lookup cost
+static bool bench_drift(void) {
+    bool ok = true;
+
+    // Every tick maps to the first mach tick it is reached at, and back
+    static const int maps[][2] = { {120, 120}, {97, 97}, {60, 240}, {300, 20}, {133, 134} };
+    int failures = 0;
+    for (size_t m = 0; m < sizeof(maps) / sizeof(maps[0]); m++) {
+        tempo_map_set_ramp(maps[m][0], maps[m][1]);
+        for (uint32_t t = 0; t < totalLoopTicks; t++) {
+            uint64_t mach = tempo_tick_to_mach(t);
+            if (tempo_mach_to_tick(mach) != t) failures++;
+            if (t && tempo_mach_to_tick(mach - 1) != t - 1) failures++;
+        }
+    }
+    printf("  tick/mach round trip, constant and ramped maps: %d failures\n", failures);
+    ok &= failures == 0;
+
+    // 10 hours of downbeats at 97 BPM against the exact loop length
+    const int bpm = 97;
+    tempo_map_set_ramp(bpm, bpm);
+    long double machPerSec = 1e9L * timebaseInfo.denom / timebaseInfo.numer;
+    long double loopSecs = totalBeats * 60.0L / bpm;
+    uint64_t loops = (uint64_t)(10 * 3600 / loopSecs);
+    uint64_t start = 0;
+    uint32_t frac = 0;
+    for (uint64_t i = 0; i < loops; i++) start = loop_start_after(start, &frac);
+    long double drift = start + frac / 4294967296.0L - loops * loopSecs * machPerSec;
+    // The previous clock divided by a truncated integer nanoseconds per tick
+    uint64_t nanosPerTick = (uint64_t)(60.0e9 / (bpm * TICKS_PER_BEAT));
+    double oldDrift = (60.0e9 / bpm * totalBeats - (double)nanosPerTick * totalLoopTicks) * loops;
+    printf("  10 h at %d BPM (%llu loops): drift %.3Lf us, truncated nanosPerTick %.1f ms\n",
+           bpm, (unsigned long long)loops, drift / machPerSec * 1e6L, oldDrift / 1e6);
+    ok &= fabsl(drift) < 1.0L;
+
+    // Position lookup: tempo table search versus the old divide and modulo
+    enum { CALLS = 20000000 };
+    uint64_t step = loopMach / CALLS + 1;
+    volatile uint32_t sink = 0;
+    double best = 1e30, bestOld = 1e30;
+    for (int run = 0; run < 5; run++) {
+        double t0 = now_us();
+        for (uint64_t i = 0; i < CALLS; i++) sink += tempo_mach_to_tick(i * step);
+        double t1 = now_us();
+        for (uint64_t i = 0; i < CALLS; i++) sink += (uint32_t)(mach_to_nanos(i * step) / nanosPerTick % totalLoopTicks);
+        double t2 = now_us();
+        if (t1 - t0 < best) best = t1 - t0;
+        if (t2 - t1 < bestOld) bestOld = t2 - t1;
+    }
+    printf("  tick lookup: %.2f ns/call (divide and modulo: %.2f ns/call)\n",
+           best * 1e3 / CALLS, bestOld * 1e3 / CALLS);
+    return ok;
+}
+
+// Event sort - the radix sort must be stable with note-offs first on a shared
+// tick; then timed against qsort on 10k events
+static int compare_event_keys(const void *a, const void *b) {
+    uint32_t ka = event_sort_key(a), kb = event_sort_key(b);
+    return ka < kb ? -1 : ka > kb;
+}
+
+static bool bench_sort(void) {
+    static MIDIEvent input[MAX_EVENTS_PER_TRACK], sorted[MAX_EVENTS_PER_TRACK];
+    srand(1);
+
+    // Note and velocity carry the input index, so stability can be checked.
+    // Odd runs crowd the events onto few ticks to exercise equal keys.
+    int failures = 0;
+    for (int run = 0; run < 50; run++) {
+        int n = rand() % MAX_EVENTS_PER_TRACK + 1;
+        uint32_t span = (run & 1) ? 200 : 4 * 7680;
+        for (int i = 0; i < n; i++) {
+            input[i] = (MIDIEvent){ (uint32_t)rand() % span, (rand() & 1) ? 0x90 : 0x80, (uint8_t)i, (uint8_t)(i >> 8) };
+        }
+        memcpy(sorted, input, n * sizeof(MIDIEvent));
+        sort_events(sorted, n);
+        for (int i = 1; i < n; i++) {
+            uint32_t k0 = event_sort_key(&sorted[i - 1]), k1 = event_sort_key(&sorted[i]);
+            int i0 = sorted[i - 1].note | sorted[i - 1].velocity << 8, i1 = sorted[i].note | sorted[i].velocity << 8;
+            if (k0 > k1 || (k0 == k1 && i0 > i1)) failures++;
+        }
+    }
+    printf("  stability and off-before-on, 50 random inputs: %d failures\n", failures);
+
+    enum { EVENTS = 10000, RUNS = 200 };
+    for (int i = 0; i < EVENTS; i++) {
+        input[i] = (MIDIEvent){ (uint32_t)rand() % (16 * 7680), (rand() & 1) ? 0x90 : 0x80, 60, 100 };
+    }
+    double best = 1e30, bestQsort = 1e30;
+    for (int run = 0; run < RUNS; run++) {
+        memcpy(sorted, input, sizeof(MIDIEvent) * EVENTS);
+        double t0 = now_us();
+        qsort(sorted, EVENTS, sizeof(MIDIEvent), compare_event_keys);
+        double t1 = now_us();
+        memcpy(sorted, input, sizeof(MIDIEvent) * EVENTS);
+        double t2 = now_us();
+        sort_events(sorted, EVENTS);
+        double t3 = now_us();
+        if (t1 - t0 < bestQsort) bestQsort = t1 - t0;
+        if (t3 - t2 < best) best = t3 - t2;
+    }
+    printf("  %d events: radix sort %.1f us, qsort %.1f us\n", EVENTS, best, bestQsort);
+    return failures == 0;
+}
+
+// Bulk quantize - the vector kernel against its scalar definition for every
+// tick, setting and loop length, and against tMr-quantize's quantize_tick
+// (round to nearest, wrap to 0) where the settings match; then timed
+static uint32_t tmr_quantize_tick(uint32_t tick, uint32_t grid, uint32_t len) {
+    if (grid == 0) return tick;
+    uint32_t gridPos = tick / grid;
+    if (tick % grid >= grid / 2) gridPos++;
+    uint32_t quantizedTick = gridPos * grid;
+    return quantizedTick >= len ? 0 : quantizedTick;
+}
+
+static bool bench_quantize(void) {
+    static uint32_t ticks[16 * 7 * TICKS_PER_BEAT];
+    static MIDITrack track;
+    long values = 0, failures = 0, tmrFailures = 0;
+
+    for (int bars = 1; bars <= 16; bars++) {
+        for (int beats = 2; beats <= 7; beats++) {
+            uint32_t len = (uint32_t)(bars * beats * TICKS_PER_BEAT);
+            for (int g = 0; g < QUANTIZE_GRID_COUNT; g++) {
+                for (int sw = 0; sw < QUANTIZE_SWING_COUNT; sw++) {
+                    for (int st = 0; st < QUANTIZE_STRENGTH_COUNT; st++) {
+                        track.quantizeGrid = (uint8_t)g;
+                        track.quantizeSwing = (uint8_t)sw;
+                        track.quantizeStrength = (uint8_t)st;
+                        QuantizeParams q = quantize_params(&track, len);
+                        for (uint32_t i = 0; i < len; i++) ticks[i] = i;
+                        quantize_ticks(ticks, (int)len, &q);
+                        for (uint32_t i = 0; i < len; i++) {
+                            uint32_t expect = q.grid ? quantize_tick_scalar(i, &q) : i;
+                            if (ticks[i] != expect || ticks[i] >= len) failures++;
+                            if (sw == 0 && st == 0 && ticks[i] != tmr_quantize_tick(i, quantizeGridTicks[g], len)) {
+                                tmrFailures++;
+                            }
+                            values++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    printf("  kernel vs scalar, %ld values: %ld mismatches\n", values, failures);
+    printf("  kernel vs tMr-quantize quantize_tick (full strength, no swing): %ld mismatches\n", tmrFailures);
+
+    // 160k ticks on a 1/16 grid: the kernel against a divide per note
+    enum { TICKS = 160000, RUNS = 50 };
+    static uint32_t input[TICKS], output[TICKS];
+    const uint32_t len = 16 * 4 * TICKS_PER_BEAT;
+    srand(1);
+    for (int i = 0; i < TICKS; i++) input[i] = (uint32_t)rand() % len;
+    track.quantizeGrid = 3;
+    track.quantizeSwing = 0;
+    track.quantizeStrength = 0;
+    QuantizeParams q = quantize_params(&track, len);
+    // Read back through volatiles, as the grid is a run-time value in the
+    // engine: constants would let the compiler turn the divides into multiplies
+    volatile uint32_t runtimeGrid = (uint32_t)q.grid, runtimeHalf = (uint32_t)q.half, runtimeLen = len;
+    uint32_t grid = runtimeGrid, half = runtimeHalf, wrap = runtimeLen;
+    double best = 1e30, bestDivide = 1e30;
+    for (int run = 0; run < RUNS; run++) {
+        memcpy(output, input, sizeof(output));
+        double t0 = now_us();
+        quantize_ticks(output, TICKS, &q);
+        double t1 = now_us();
+        for (int i = 0; i < TICKS; i++) output[i] = (input[i] + half) / grid * grid % wrap;
+        double t2 = now_us();
+        if (t1 - t0 < best) best = t1 - t0;
+        if (t2 - t1 < bestDivide) bestDivide = t2 - t1;
+    }
+    printf("  %d ticks: kernel %.0f us, divide loop %.0f us\n", TICKS, best, bestDivide);
+    return failures == 0 && tmrFailures == 0;
+}
+
+// Aliasing - a steady saw from the band-limited tables against a naive
+// (trivially sampled) saw: energy away from the harmonics of f0, relative to
+// the energy on them, from a Hann-windowed FFT
+enum { ALIAS_FFT = 32768 };
+static double fftRe[ALIAS_FFT], fftIm[ALIAS_FFT];
+
+static void fft(double *re, double *im, int n) {
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            double t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for (int len = 2; len <= n; len <<= 1) {
+        double angle = -2.0 * M_PI / len;
+        for (int i = 0; i < n; i += len) {
+            for (int k = 0; k < len / 2; k++) {
+                double wr = cos(angle * k), wi = sin(angle * k);
+                double *ar = &re[i + k], *ai = &im[i + k], *br = &re[i + k + len / 2], *bi = &im[i + k + len / 2];
+                double xr = *br * wr - *bi * wi, xi = *br * wi + *bi * wr;
+                *br = *ar - xr;
+                *bi = *ai - xi;
+                *ar += xr;
+                *ai += xi;
+            }
+        }
+    }
+}
+
+static double alias_db(const float *x, double f0) {
+    for (int i = 0; i < ALIAS_FFT; i++) {
+        fftRe[i] = x[i] * (0.5 - 0.5 * cos(2.0 * M_PI * i / ALIAS_FFT));
+        fftIm[i] = 0.0;
+    }
+    fft(fftRe, fftIm, ALIAS_FFT);
+    const double binHz = SYNTH_SAMPLE_RATE / ALIAS_FFT;
+    double harmonic = 0.0, alias = 0.0;
+    for (int k = 1; k < ALIAS_FFT / 2; k++) {
+        double h = k * binHz / f0;
+        double energy = fftRe[k] * fftRe[k] + fftIm[k] * fftIm[k];
+        if (fabs(h - round(h)) * f0 < 4 * binHz) harmonic += energy;  // Window main lobe
+        else alias += energy;
+    }
+    return 10.0 * log10(alias / harmonic);
+}
+
+static bool bench_alias(void) {
+    static float wave[ALIAS_FFT];
+    static const int notes[] = { 60, 84, 96, 108 };
+    bool ok = true;
+    for (size_t n = 0; n < sizeof(notes) / sizeof(notes[0]); n++) {
+        double f0 = note_hz(notes[n]);
+        const float *table = wavetables[WAVE_SAW][wavetable_level(notes[n])];
+        uint32_t inc = hz_to_phase_inc(f0), phase = 0;
+        for (int i = 0; i < ALIAS_FFT; i++, phase += inc) wave[i] = wavetable_read(table, phase);
+        double bandLimited = alias_db(wave, f0);
+        phase = 0;
+        for (int i = 0; i < ALIAS_FFT; i++, phase += inc) wave[i] = phase / 2147483648.0f - 1.0f;
+        double naive = alias_db(wave, f0);
+        printf("  note %3d (%5.0f Hz): wavetable %.1f dB, naive saw %.1f dB\n", notes[n], f0, bandLimited, naive);
+        ok &= bandLimited < -40.0;
+    }
+    return ok;
+}
+
+// Startup - what the constant tables cost the engine: its first pass over
+// every level, in a fresh child so none of their pages is mapped yet, against
+// summing them additively at startup as tMwavegen does. The sums must match
+// tMwavetables.h (a stale header fails).
+static float startupTable[WAVETABLE_SIZE];
+
+static double additive_coefficient(int wave, int k, bool *cosine) {
+    *cosine = false;
+    switch (wave) {
+        case WAVE_SAW: return ((k & 1) ? 1.0 : -1.0) / k;
+        case WAVE_SQUARE: return (k & 1) ? 1.0 / k : 0.0;
+        case WAVE_TRIANGLE: return (k & 1) ? (((k >> 1) & 1) ? -1.0 : 1.0) / ((double)k * k) : 0.0;
+        default: *cosine = true; return sin(M_PI * k * 0.25) / k;  // 25% pulse
+    }
+}
+
+static void additive_table(int wave, int level, float *out) {
+    static double sum[WAVETABLE_SIZE];
+    double top = 440.0 * pow(2.0, (12.0 * (level + 1) - 69.0) / 12.0);
+    int harmonics = (int)(SYNTH_SAMPLE_RATE / 2.0 / top);
+    if (harmonics > WAVETABLE_SIZE / 2 - 1) harmonics = WAVETABLE_SIZE / 2 - 1;
+    if (harmonics < 1) harmonics = 1;
+
+    double mean = 0.0, peak = 0.0;
+    for (int i = 0; i < WAVETABLE_SIZE; i++) {
+        double x = 2.0 * M_PI * i / WAVETABLE_SIZE;
+        sum[i] = 0.0;
+        for (int k = 1; k <= harmonics; k++) {
+            bool cosine;
+            double c = additive_coefficient(wave, k, &cosine);
+            if (c != 0.0) sum[i] += c * (cosine ? cos(k * x) : sin(k * x));
+        }
+        mean += sum[i];
+    }
+    mean /= WAVETABLE_SIZE;
+    for (int i = 0; i < WAVETABLE_SIZE; i++) {
+        sum[i] -= mean;
+        if (fabs(sum[i]) > peak) peak = fabs(sum[i]);
+    }
+    for (int i = 0; i < WAVETABLE_SIZE; i++) out[i] = (float)(sum[i] / peak);
+}
+
+static bool bench_startup(void) {
+    double *cold = mmap(NULL, 2 * sizeof(double), PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, -1, 0);
+    if (cold == MAP_FAILED) return false;
+    fflush(stdout);  // The child must not inherit unwritten output
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Read each table every 512 samples (2 KB), so every page is touched
+        for (int pass = 0; pass < 2; pass++) {
+            volatile float sink = 0.0f;
+            double t0 = now_us();
+            for (int w = 0; w < WAVE_COUNT; w++) {
+                for (int l = 0; l < WAVETABLE_LEVELS; l++) {
+                    for (uint32_t i = 0; i < 4; i++) sink += wavetable_read(wavetables[w][l], i << 30);
+                    sink += wavetables[w][l][WAVETABLE_SIZE];
+                }
+            }
+            cold[pass] = now_us() - t0;
+        }
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    double t0 = now_us(), worst = 0.0;
+    for (int w = 0; w < WAVE_COUNT; w++) {
+        for (int l = 0; l < WAVETABLE_LEVELS; l++) {
+            additive_table(w, l, startupTable);
+            for (int i = 0; i < WAVETABLE_SIZE; i++) {
+                double d = fabs(startupTable[i] - wavetables[w][l][i]);
+                if (d > worst) worst = d;
+            }
+        }
+    }
+    double generate = now_us() - t0;
+    printf("  first use of %d tables: %.0f us cold, %.1f us warm\n", WAVE_COUNT * WAVETABLE_LEVELS, cold[0], cold[1]);
+    printf("  additive generation at startup: %.0f us (largest difference from the header %.1e)\n", generate, worst);
+    ok &= worst < 1e-6;
+    munmap(cold, 2 * sizeof(double));
+    return ok;
+}
+
+// Native synth helpers - render straight through the render callback, on the
+// calling thread plus whatever workers render_workers_start made
+static float benchLeft[SYNTH_MAX_FRAMES * 2], benchRight[SYNTH_MAX_FRAMES * 2];
+
+static void bench_render(UInt32 frames) {
+    struct { UInt32 count; AudioBuffer buffers[2]; } list = {
+        2, { { 1, frames * sizeof(float), benchLeft }, { 1, frames * sizeof(float), benchRight } }
+    };
+    synth_render(NULL, NULL, NULL, 1, frames, (AudioBufferList *)&list);
+}
+
+static void bench_synth_reset(void) {
+    voiceFreeMask = ~0ull;
+    voiceListHead[0] = voiceListHead[1] = voiceListTail[0] = voiceListTail[1] = -1;
+    memset(voiceMap, -1, sizeof(voiceMap));
+    memset(fxReverbRing, 0, sizeof(fxReverbRing));
+    memset(fxReverbDamp, 0, sizeof(fxReverbDamp));
+    memset(fxChorusRing, 0, sizeof(fxChorusRing));
+    memset(fxDelayRing, 0, sizeof(fxDelayRing));
+    fxReverbPos = fxChorusPos = fxDelayPos = 0;
+    fxChorusPhase = 0.0f;
+    fx_init();
+}
+
+// Voices per core - 64 held voices, either all on channel 1 (one program) or
+// spread over the 15 melodic channels with mixed programs (filter lanes are
+// grouped across channels either way; spread voices cost more mixer strips and
+// effect sends per block, and different patches), rendered in 512-frame
+// callbacks. The figure is the average number of active
+// voices times how many times faster than real time (at 48 kHz) one thread
+// renders them.
+static double voices_per_core(bool spread, bool filtered) {
+    enum { BLOCK = 512, BLOCKS = 100, RUNS = 40 };
+    double best = 0.0;
+    for (int run = 0; run < RUNS; run++) {
+        bench_synth_reset();
+        for (int v = 0; v < SYNTH_VOICES; v++) {
+            int channel = v % (MIDI_TRACKS - 1);
+            if (channel >= DRUM_CHANNEL) channel++;
+            synthPrograms[channel] = (uint8_t)(channel * 8);
+            if (!spread) channel = 0;
+            synth_note_on((uint8_t)channel, (uint8_t)(36 + v * 5 % 48), 100, 0);
+        }
+        if (!filtered) {
+            for (int v = 0; v < SYNTH_VOICES; v++) synthVoices[v].filterMode = FILTER_OFF;
+        }
+        long active = 0;
+        double t0 = thread_cpu_us();
+        for (int b = 0; b < BLOCKS; b++) {
+            bench_render(BLOCK);
+            active += __builtin_popcountll(~voiceFreeMask);
+        }
+        double seconds = (thread_cpu_us() - t0) / 1e6;
+        double voices = (double)active / BLOCKS * (BLOCKS * BLOCK / 48000.0) / seconds;
+        if (voices > best) best = voices;
+    }
+    return best;
+}
+
+static bool bench_voices(void) {
+    // Sanity: every program renders finite output within full scale
+    float peak = 0.0f;
+    int nonFinite = 0;
+    for (int p = 0; p < 128; p++) {
+        bench_synth_reset();
+        synthPrograms[0] = (uint8_t)p;
+        synth_note_on(0, 60, 100, 0);
+        for (int b = 0; b < 20; b++) {
+            bench_render(512);
+            for (int i = 0; i < 512; i++) {
+                if (!isfinite(benchLeft[i])) nonFinite++;
+                else if (fabsf(benchLeft[i]) > peak) peak = fabsf(benchLeft[i]);
+            }
+        }
+    }
+    printf("  128 programs: peak %.3f, %d non-finite samples\n", peak, nonFinite);
+
+    for (int spread = 0; spread < 2; spread++) {
+        printf("  voices per core at 48 kHz, %s: %.0f filtered, %.0f with the filter bypassed\n",
+               spread ? "15 channels" : "one channel", voices_per_core(spread, true), voices_per_core(spread, false));
+    }
+    return nonFinite == 0 && peak < 1.0f;
+}
+
+// Render threads - the same script of overlapping notes on all 16 channels,
+// in mixed callback sizes, rendered with 1 to SYNTH_MAX_THREADS threads. Each
+// count runs in a fresh child process (workers, effect rings and voices all
+// start clean) and writes its output to shared memory; every count must match
+// the single-threaded output bit for bit.
+enum { SCRIPT_FRAMES = 190000 };
+
+static void render_script(float *out) {
+    static const UInt32 sizes[] = { 512, 64, 100, 4096, 5000, 37 };
+    UInt32 pos = 0;
+    for (int b = 0;; b++) {
+        if (b % 3 == 0) {
+            for (int k = 0; k < 8; k++) {
+                int channel = (b + k) % MIDI_TRACKS;
+                synthPrograms[channel] = (uint8_t)((b * 5 + k * 11) & 127);
+                synth_note_on((uint8_t)channel, (uint8_t)(30 + (b * 7 + k * 13) % 60), (uint8_t)(60 + k * 7), (uint16_t)(b * k % 64));
+            }
+        }
+        if (b % 3 == 2) {
+            for (int k = 0; k < 8; k += 2) {
+                synth_note_off((uint8_t)((b - 2 + k) % MIDI_TRACKS), (uint8_t)(30 + ((b - 2) * 7 + k * 13) % 60), (uint16_t)(b * k % 64));
+            }
+        }
+        UInt32 frames = sizes[b % 6];
+        if (pos + frames > SCRIPT_FRAMES) break;
+        bench_render(frames);
+        if (out) memcpy(out + pos, benchLeft, frames * sizeof(float));
+        pos += frames;
+    }
+}
+
+static bool bench_threads(void) {
+    size_t outBytes = (size_t)SYNTH_MAX_THREADS * SCRIPT_FRAMES * sizeof(float);
+    float *out = mmap(NULL, outBytes + SYNTH_MAX_THREADS * sizeof(double), PROT_READ | PROT_WRITE,
+                      MAP_ANON | MAP_SHARED, -1, 0);
+    if (out == MAP_FAILED) return false;
+    double *wall = (double *)((char *)out + outBytes);
+
+    bool ok = true;
+    for (int threads = 1; threads <= SYNTH_MAX_THREADS; threads++) {
+        float *mine = out + (size_t)(threads - 1) * SCRIPT_FRAMES;
+        fflush(stdout);  // The child must not inherit unwritten output
+        pid_t pid = fork();
+        if (pid == 0) {
+            char count[8];
+            snprintf(count, sizeof(count), "%d", threads);
+            setenv(SYNTH_THREADS_ENV, count, 1);
+            render_workers_start();
+            int started = synthThreadCount;
+            double best = 1e30;
+            for (int run = 0; run < 3; run++) {
+                bench_synth_reset();
+                double t0 = now_us();
+                render_script(run == 0 ? mine : NULL);
+                double elapsed = now_us() - t0;
+                if (elapsed < best) best = elapsed;
+            }
+            wall[threads - 1] = best;
+            render_workers_stop();
+            _exit(started == threads ? 0 : 1);
+        }
+        int status = 0;
+        if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("  %d threads: could not start\n", threads);
+            ok = false;
+            continue;
+        }
+        bool identical = memcmp(mine, out, SCRIPT_FRAMES * sizeof(float)) == 0;
+        printf("  %d thread%s: %.1f ms for %.1f s of audio, %.2fx, output %s\n", threads, threads > 1 ? "s" : "",
+               wall[threads - 1] / 1e3, SCRIPT_FRAMES / SYNTH_SAMPLE_RATE, wall[0] / wall[threads - 1],
+               identical ? "identical" : "DIFFERS");
+        ok &= identical;
+    }
+    double energy = 0.0;
+    for (int i = 0; i < SCRIPT_FRAMES; i++) energy += (double)out[i] * out[i];
+    printf("  output energy %.1f, %ld cores online\n", energy, sysconf(_SC_NPROCESSORS_ONLN));
+    ok &= energy > 0.0;
+    munmap(out, outBytes + SYNTH_MAX_THREADS * sizeof(double));
+    return ok;
+}
+
+static const struct {
+    const char *name;
+    const char *what;
+    bool (*run)(void);
+} sections[] = {
+    { "drift", "Fixed-point clock", bench_drift },
+    { "sort", "Radix event sort", bench_sort },
+    { "quantize", "Bulk quantize kernel", bench_quantize },
+    { "alias", "Band-limited wavetables", bench_alias },
+    { "startup", "Build-time wavetables", bench_startup },
+    { "voices", "Four-lane voice filter", bench_voices },
+    { "threads", "Parallel render threads", bench_threads },
+};
+
+int main(int argc, char *argv[]) {
+    init_timing();
+    synthMachPerFrame = 1e9 / SYNTH_SAMPLE_RATE * timebaseInfo.denom / timebaseInfo.numer;
+    int failed = 0, ran = 0;
+    for (size_t s = 0; s < sizeof(sections) / sizeof(sections[0]); s++) {
+        bool wanted = argc < 2;
+        for (int a = 1; a < argc; a++) {
+            if (strcmp(argv[a], sections[s].name) == 0) wanted = true;
+        }
+        if (!wanted) continue;
+        printf("%s - %s\n", sections[s].name, sections[s].what);
+        fflush(stdout);
+        bool ok = sections[s].run();
+        printf("  %s\n\n", ok ? "ok" : "FAILED");
+        if (!ok) failed++;
+        ran++;
+    }
+    if (ran == 0) {
+        fprintf(stderr, "Usage: %s [section...]\nSections:", argv[0]);
+        for (size_t s = 0; s < sizeof(sections) / sizeof(sections[0]); s++) fprintf(stderr, " %s", sections[s].name);
+        fprintf(stderr, "\n");
+        return 2;
+    }
+    return failed ? 1 : 0;
+}
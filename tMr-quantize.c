@@ -8,6 +8,9 @@
  *   Middle: a s d f g h j k l
  *   Bottom: z x c v b n m
  *
+ * Quantization is non-destructive: recorded ticks are kept as played and the
+ * grid is applied at playback and save, so changing or disabling it is lossless.
+ *
  * Controls:
  *   SPACE     = Start/Stop master clock
  *   CAPSLOCK  = Start/Stop recording (requires clock running)
@@ -65,6 +68,7 @@ typedef struct {
 // Track structure
 typedef struct {
     MIDIEvent events[MAX_EVENTS_PER_TRACK];
+    uint32_t playTicks[MAX_EVENTS_PER_TRACK];  // events[i].tick on the current grid
     int eventCount;
     int program;
 } MIDITrack;
@@ -319,10 +323,9 @@ static void note_on(uint8_t note, uint8_t velocity) {
         MIDITrack *track = &tracks[currentChannel];
         if (track->eventCount < MAX_EVENTS_PER_TRACK) {
             uint32_t tick = get_current_tick();
-            // Apply quantization to the tick
-            tick = quantize_tick(tick);
 
             track->events[track->eventCount].tick = tick;
+            track->playTicks[track->eventCount] = quantize_tick(tick);
             track->events[track->eventCount].status = 0x90;
             track->events[track->eventCount].note = note;
             track->events[track->eventCount].velocity = velocity;
@@ -343,10 +346,9 @@ static void note_off(uint8_t note) {
         MIDITrack *track = &tracks[channel];
         if (track->eventCount < MAX_EVENTS_PER_TRACK) {
             uint32_t tick = get_current_tick();
-            // Apply quantization to note-off as well
-            tick = quantize_tick(tick);
 
             track->events[track->eventCount].tick = tick;
+            track->playTicks[track->eventCount] = quantize_tick(tick);
             track->events[track->eventCount].status = 0x80;
             track->events[track->eventCount].note = note;
             track->events[track->eventCount].velocity = 0;
@@ -389,6 +391,14 @@ static void channel_change(int channel) {
 // Cycle through quantize options
 static void cycle_quantize(void) {
     quantizeIndex = (quantizeIndex + 1) % QUANTIZE_OPTIONS;
+
+    // Re-snap the playback ticks once here rather than on every timer tick
+    for (int t = 0; t < MIDI_TRACKS; t++) {
+        MIDITrack *track = &tracks[t];
+        for (int i = 0; i < track->eventCount; i++) {
+            track->playTicks[i] = quantize_tick(track->events[i].tick);
+        }
+    }
     update_status_display();
 }
 
@@ -401,12 +411,13 @@ static void play_events_in_range(uint32_t startTick, uint32_t endTick) {
         MIDITrack *track = &tracks[t];
         for (int i = 0; i < track->eventCount; i++) {
             MIDIEvent *ev = &track->events[i];
+            uint32_t tick = track->playTicks[i];
             bool inRange;
             if (startTick <= endTick) {
-                inRange = (ev->tick >= startTick && ev->tick < endTick);
+                inRange = (tick >= startTick && tick < endTick);
             } else {
                 // Wrapped around
-                inRange = (ev->tick >= startTick || ev->tick < endTick);
+                inRange = (tick >= startTick || tick < endTick);
             }
 
             if (inRange) {
@@ -737,6 +748,9 @@ static int compare_events(const void *a, const void *b) {
     return 0;
 }
 
+// Quantized copy of a track's events for saving (recorded ticks stay raw)
+static MIDIEvent saveEvents[MAX_EVENTS_PER_TRACK];
+
 static void save_midi_file(void) {
     time_t now = time(NULL);
     struct tm *gmt = gmtime(&now);
@@ -807,8 +821,12 @@ static void save_midi_file(void) {
         MIDITrack *track = &tracks[t];
         if (track->eventCount == 0) continue;
 
-        // Sort events by tick
-        qsort(track->events, track->eventCount, sizeof(MIDIEvent), compare_events);
+        // Apply the quantize grid to a copy, then sort by tick
+        for (int i = 0; i < track->eventCount; i++) {
+            saveEvents[i] = track->events[i];
+            saveEvents[i].tick = track->playTicks[i];
+        }
+        qsort(saveEvents, track->eventCount, sizeof(MIDIEvent), compare_events);
 
         fwrite("MTrk", 1, 4, f);
         trackLenPos = ftell(f);
@@ -823,7 +841,7 @@ static void save_midi_file(void) {
         // Write events
         uint32_t lastTick = 0;
         for (int i = 0; i < track->eventCount; i++) {
-            MIDIEvent *ev = &track->events[i];
+            MIDIEvent *ev = &saveEvents[i];
             uint32_t delta = ev->tick - lastTick;
             lastTick = ev->tick;
 
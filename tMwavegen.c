@@ -0,0 +1,99 @@
+/**
+ * tMwavegen.c - Band-limited wavetable generator for terminalMIDI
+ *
+ * Build: clang -O2 tMwavegen.c -o tMwavegen && ./tMwavegen > tMwavetables.h
+ *
+ * Writes a header of constant tables (saw, square, triangle, 25% pulse), one
+ * mip level per MIDI octave. Each level is summed additively from only the
+ * harmonics that stay below Nyquist for the highest note of its octave, so
+ * the oscillator never aliases and the tables cost nothing at startup - they
+ * are read-only data shared between processes.
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+// Must match SYNTH_SAMPLE_RATE (terminalMIDI.c checks WAVETABLE_SAMPLE_RATE at compile time)
+#define SAMPLE_RATE 44100.0
+#define TABLE_SIZE 2048                  // Power of two; one guard sample is appended
+#define TABLE_LEVELS 11                  // MIDI octaves 0-10 (notes 0-131)
+#define MAX_HARMONICS (TABLE_SIZE / 2 - 1)
+
+enum { WAVE_SAW, WAVE_SQUARE, WAVE_TRIANGLE, WAVE_PULSE, WAVE_COUNT };
+static const char *waveNames[WAVE_COUNT] = { "saw", "square", "triangle", "pulse 25%" };
+
+// Fourier coefficient (sine and cosine parts) of harmonic k
+static void harmonic(int wave, int k, double *sinPart, double *cosPart) {
+    *sinPart = 0.0;
+    *cosPart = 0.0;
+    switch (wave) {
+        case WAVE_SAW:
+            *sinPart = ((k & 1) ? 1.0 : -1.0) / k;
+            break;
+        case WAVE_SQUARE:
+            if (k & 1) *sinPart = 1.0 / k;
+            break;
+        case WAVE_TRIANGLE:
+            if (k & 1) *sinPart = (((k >> 1) & 1) ? -1.0 : 1.0) / ((double)k * k);
+            break;
+        case WAVE_PULSE: {
+            // Duty d: sin(pi k d) / k, as cosine terms about the pulse centre
+            *cosPart = sin(M_PI * k * 0.25) / k;
+            break;
+        }
+    }
+}
+
+static void generate(int wave, int level, double *out) {
+    double top = 440.0 * pow(2.0, (12.0 * (level + 1) - 69.0) / 12.0);  // Lowest note of next octave
+    int harmonics = (int)(SAMPLE_RATE / 2.0 / top);
+    if (harmonics > MAX_HARMONICS) harmonics = MAX_HARMONICS;
+    if (harmonics < 1) harmonics = 1;
+
+    double peak = 0.0, mean = 0.0;
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        double x = 2.0 * M_PI * i / TABLE_SIZE;
+        double sum = 0.0;
+        for (int k = 1; k <= harmonics; k++) {
+            double s, c;
+            harmonic(wave, k, &s, &c);
+            if (s != 0.0) sum += s * sin(k * x);
+            if (c != 0.0) sum += c * cos(k * x);
+        }
+        out[i] = sum;
+        mean += sum;
+    }
+    mean /= TABLE_SIZE;
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        out[i] -= mean;
+        if (fabs(out[i]) > peak) peak = fabs(out[i]);
+    }
+    for (int i = 0; i < TABLE_SIZE; i++) out[i] /= peak;
+}
+
+int main(void) {
+    static double table[TABLE_SIZE];
+
+    printf("// Generated by tMwavegen - do not edit\n");
+    printf("#ifndef TM_WAVETABLES_H\n#define TM_WAVETABLES_H\n\n");
+    printf("#define WAVETABLE_SIZE %d\n", TABLE_SIZE);
+    printf("#define WAVETABLE_LEVELS %d\n", TABLE_LEVELS);
+    printf("#define WAVETABLE_SAMPLE_RATE %.1f\n\n", SAMPLE_RATE);
+    printf("enum { WAVE_SAW, WAVE_SQUARE, WAVE_TRIANGLE, WAVE_PULSE, WAVE_COUNT };\n\n");
+    printf("// [wave][octave][sample]; level n is band-limited for MIDI notes 12n to 12n+11\n");
+    printf("static const float wavetables[WAVE_COUNT][WAVETABLE_LEVELS][WAVETABLE_SIZE + 1] = {\n");
+    for (int w = 0; w < WAVE_COUNT; w++) {
+        printf("  { // %s\n", waveNames[w]);
+        for (int l = 0; l < TABLE_LEVELS; l++) {
+            generate(w, l, table);
+            printf("    {");
+            for (int i = 0; i <= TABLE_SIZE; i++) {
+                printf("%s%.8ef", i % 8 ? ", " : (i ? ",\n     " : ""), table[i % TABLE_SIZE]);
+            }
+            printf("},\n");
+        }
+        printf("  },\n");
+    }
+    printf("};\n\n#endif\n");
+    return 0;
+}
@@ -2,13 +2,71 @@
  * tmw software programmed with claude-code
  * terminalMIDI.c - Terminal MIDI Synthesizer with 16-track recorder (optimised)
  *
- * Build: clang -framework AudioToolbox -framework CoreMIDI -framework ApplicationServices -framework CoreFoundation terminalMIDI.c -o terminalMIDI
+ * Build: clang -O2 tMwavegen.c -o tMwavegen && ./tMwavegen > tMwavetables.h
+ *        clang -framework AudioToolbox -framework CoreMIDI -framework ApplicationServices -framework CoreFoundation terminalMIDI.c -o terminalMIDI
  *
  * Optimisations:
  *   - O(1) keycode lookup table (was O(n) linear search)
  *   - Drift-corrected beat scheduling using mach_absolute_time
  *   - Tempo-adaptive playback timer interval
  *   - Metronome synced to beat 1 of master clock
+ *   - Tempo map (step + linear ramp segments) with precomputed cumulative table,
+ *     O(log n) tick<->time lookup and no float math on the hot path
+ *   - Per-track loop lengths: each track's cursor wraps independently against
+ *     the absolute song position (short patterns stored once, not unrolled)
+ *   - Tracks store paired note records (start, length, pitch, velocity); wire
+ *     events are generated lazily, so every note-on always has its note-off
+ *   - Non-destructive per-track quantize (grid, swing, strength) applied when a
+ *     track's playback index is rebuilt; only changed tracks are rebuilt
+ *   - Groove templates: per-16th offset/velocity table extracted and applied
+ *     in single linear passes, used as a quantize grid
+ *   - O(log n) locate: per-track binary search, and sustained notes chased
+ *     from a per-bar snapshot plus at most one bar of events; loop region A-B
+ *     relocates on the scheduled beat
+ *   - Replace / punch recording: the playhead only extends a covered interval
+ *     (muted at playback); it is erased with binary search and one memmove on
+ *     start-sorted notes once per pass
+ *   - Vectorised bulk quantize / transpose / velocity kernels (reciprocal
+ *     multiply instead of a divide per note), scalar fallback for the tail
+ *   - Stable O(n) LSD radix sort for event ordering (note-offs before note-ons
+ *     on the same tick); playback walks sorted tracks with a cursor, not a scan
+ *   - Compact SMF output: running status with note-on velocity 0 note-offs
+ *     (two bytes per event instead of three)
+ *   - Overdub passes kept as takes in one shared append-only note arena;
+ *     comping flips a per-bar take mask and rebuilds that track's events,
+ *     reading its takes in place (take notes are never copied into the track)
+ *   - Undo/redo history: per-edit track snapshots over shared, reference-
+ *     counted note chunks (copy-on-write); restoring copies only changed chunks
+ *   - Native synth engine: fixed 64-voice pool, free voices found with one
+ *     count-trailing-zeros on a bitset, O(1) per-(channel, note) voice map and
+ *     intrusive LRU stealing (released voices first); notes reach the render
+ *     thread through a wait-free single-producer queue, stamped so notes,
+ *     note-offs and All Notes Off land on their own frame of the block
+ *   - GM patch bank as a 12-byte parametric table per program (two oscillators,
+ *     resonant filter, ADSR) plus a drum map and kit variations for channel 10,
+ *     turned into per-voice coefficients once at note-on
+ *   - SoundFont (SF2) playback from a memory-mapped bank ($TERMINALMIDI_SF2):
+ *     only the preset tables are parsed, samples stream from the mapping
+ *   - WAV drum sampler for channel 10 ($TERMINALMIDI_DRUMS/<note>.wav, mapped)
+ *   - Metronome clicks start on the exact frame of the beat, on their own
+ *     path past the mixer strips (track mute and solo never silence them)
+ *   - Band-limited wavetable oscillators (one mip level per octave) generated
+ *     at build time into constant data: no startup cost, no aliasing
+ *   - Send effects bus (CC91 reverb, CC93 chorus, CC94 delay): 8-line FDN
+ *     reverb, modulated chorus and ping-pong delay in static rings, run once
+ *     per block on the summed sends, independent of voice count
+ *   - 16-strip mixer on the native engine (CC7 volume, CC10 pan, CC11
+ *     expression) with per-block gain smoothing; peak meters come out of the
+ *     mix loop itself
+ *   - Voice filters run four voices per vector (one voice per lane) with
+ *     coefficients ramped across 64-frame control blocks; open-filter voices
+ *     skip the filter entirely
+ *   - Voices render in parallel by channel on up to 4 threads (one per core,
+ *     or $TERMINALMIDI_RENDER_THREADS): each channel bus has a single writer,
+ *     so the output is bit-identical to rendering on one thread
+ *   - Always-on retrospective capture in a fixed, allocation-free ring buffer
+ *   - Fixed-point reciprocal clock math (multiply + shift, no division) and a
+ *     fractional loop-start accumulator, so position is exact over hours
  *
  * Keyboard Layout:
  *   Top:    q w e r t y u i o p  (MIDI notes, octave adjustable)
@@ -19,11 +77,32 @@
  *   SPACE     = Start/Stop master clock
  *   CAPSLOCK  = Start/Stop recording (requires clock running)
  *   TAB       = Toggle metronome
+ *   SHIFT+TAB = Cycle record mode (overdub, replace, punch in loop region)
  *   LEFT/RIGHT = Octave down/up
  *   UP/DOWN   = Tempo up/down (hold)
+ *   SHIFT+UP/DOWN = Loop-end tempo up/down (hold) for a linear tempo ramp
  *   - =       = MIDI channel down/up
+ *   SHIFT+- = = Current track transpose down/up (playback, non-destructive)
+ *   , .       = Loop length down/up (1-16 bars)
+ *   ;         = Cycle time signature (2/4 to 7/4)
+ *   SHIFT+, . = Current track loop length down/up (polymetric, 0 = follow loop)
+ *   `         = Cycle current track quantize grid (off, 1/4-1/32, triplets, groove)
+ *   SHIFT+`   = Cycle current track swing (50-75%)
+ *   SHIFT+\   = Cycle current track quantize strength (100/75/50/25%)
+ *   '         = Capture: commit notes played (not recorded) in the last 30s to current track
+ *   SHIFT+'   = Extract groove (per-16th timing and velocity) from current track
+ *   HOME      = Locate to loop region start (or bar 1)
+ *   END       = Toggle loop region A-B
+ *   PGUP/PGDN = Locate one bar back/forward (chases held notes and programs)
+ *   SHIFT+PGUP/PGDN = Set loop region A / B at the current bar
  *   [ ]       = Program change down/up (hold)
- *   0-9       = Select MIDI output (0=internal, 1-9=external)
+ *   SHIFT+[ ] = Current track velocity scale down/up (1/8 steps)
+ *   0-9       = Select MIDI output (0=internal, 1-9=external; 0 again = DLS / native synth)
+ *   SHIFT+1-9 = Comp: play only that take in the current bar (SHIFT+0 = all takes)
+ *   RETURN    = Undo last track edit (SHIFT+RETURN = redo)
+ *   F1/F2     = Current track volume down/up (CC7)
+ *   F3/F4     = Current track pan left/right (CC10)
+ *   F5/F6     = Current track mute / solo (muted tracks are sent CC7 0)
  *   /         = Save MIDI file
  *   \         = Panic (all notes off on all channels)
  *   ESC       = Quit
@@ -33,23 +112,83 @@
 #include <CoreMIDI/CoreMIDI.h>
 #include <ApplicationServices/ApplicationServices.h>
 #include <CoreFoundation/CoreFoundation.h>
+#include <mach/mach.h>
 #include <mach/mach_time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <termios.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <math.h>
+
+#include "tMwavetables.h"  // Generated by tMwavegen (see Build)
 
 // Constants
 #define MAX_EVENTS_PER_TRACK 10000
-#define BEATS_PER_BAR 4
-#define TOTAL_BARS 4
-#define TOTAL_BEATS (BEATS_PER_BAR * TOTAL_BARS)
+#define MAX_NOTES_PER_TRACK (MAX_EVENTS_PER_TRACK / 2)  // Each note expands to two events
+#define DEFAULT_BEATS_PER_BAR 4
+#define DEFAULT_LOOP_BARS 4
+#define MIN_BEATS_PER_BAR 2
+#define MAX_BEATS_PER_BAR 7
+#define MAX_LOOP_BARS 16
 #define MIDI_TRACKS 16
 #define TICKS_PER_BEAT 480  // Standard MIDI resolution
 #define TICKS_PER_16TH (TICKS_PER_BEAT / 4)  // 120 ticks per 16th note
+#define MAX_TEMPO_SEGMENTS 16
+#define MAX_TEMPO_NODES 1024
+#define TEMPO_RAMP_STEP (TICKS_PER_BEAT / 8)  // Ramps are stepped every 32nd note (60 ticks)
+#define CAPTURE_RING_SIZE 2048  // Power of two
+#define CAPTURE_SECONDS 30
+#define MIN_BPM 20
+#define MAX_BPM 300
+#define QUANTIZE_GRID_COUNT 8
+#define QUANTIZE_GRID_GROOVE (QUANTIZE_GRID_COUNT - 1)  // Quantize toward the extracted groove
+#define RECORD_MODE_COUNT 3
+#define GROOVE_MAX_SLOTS (MAX_BEATS_PER_BAR * 4)          // One bar of 16ths
+#define QUANTIZE_SWING_COUNT 6
+#define QUANTIZE_STRENGTH_COUNT 4
+#define MAX_TAKES_PER_TRACK 9                             // Comped with SHIFT+1-9
+#define TAKE_ARENA_NOTES (MAX_NOTES_PER_TRACK * 8)        // Shared by all tracks' takes
+#define UNDO_LEVELS 256
+#define UNDO_CHUNK_NOTES 64
+#define UNDO_CHUNKS_PER_TRACK ((MAX_NOTES_PER_TRACK + UNDO_CHUNK_NOTES - 1) / UNDO_CHUNK_NOTES)
+#define UNDO_CHUNK_POOL 4096                              // 3 MB of notes, shared by all levels
+#define SYNTH_VOICES 64                                   // One bit each in the free-voice mask
+#define SYNTH_SAMPLE_RATE 44100.0
+#define SYNTH_QUEUE_SIZE 1024                             // Power of two
+#define SYNTH_BLOCK 64                                    // Control block: filter coefficients ramp across it
+#define SYNTH_LANES 4                                     // Voices filtered together (one vec_f32)
+#define SYNTH_MAX_FRAMES 4096                             // Frames rendered per pass (larger callbacks loop)
+#define SYNTH_MAX_THREADS 4                               // Render thread plus workers
+#define SYNTH_PARALLEL_VOICES 12                          // Fewer active voices render on one thread
+#define SYNTH_THREADS_ENV "TERMINALMIDI_RENDER_THREADS"   // Override the render thread count
+#define FX_REVERB_LINES 8                                 // Feedback delay network size (power of two)
+#define FX_REVERB_RING 4096                               // Frames per reverb line (power of two)
+#define FX_CHORUS_RING 2048
+#define FX_DELAY_RING 65536                               // 1.48 s: dotted eighth down to 30 BPM
+#define WAVETABLE_PHASE_SHIFT (32 - __builtin_ctz(WAVETABLE_SIZE))  // Top log2(size) bits index
+#define WAVETABLE_PHASE_MASK ((1u << WAVETABLE_PHASE_SHIFT) - 1)
+#define DRUM_CHANNEL 9
+#define DRUM_FIRST_NOTE 35                                // GM percussion map: notes 35-81
+#define DRUM_NOTE_COUNT 47
+#define DRUM_KIT_COUNT 9
+#define SF2_ENV "TERMINALMIDI_SF2"                        // Path of a SoundFont to play from
+#define SF2_DRUM_BANK 128
+#define DRUM_WAV_ENV "TERMINALMIDI_DRUMS"                 // Directory of <note>.wav drum samples
+#define SYNTH_PENDING SYNTH_QUEUE_SIZE                    // Timed messages waiting for their block
+#define SYNTH_CLICK 0xF9                                  // Queue-only status: metronome click (note, velocity)
+
+// The tables are generated offline; catch a stale header at compile time
+_Static_assert((WAVETABLE_SIZE & (WAVETABLE_SIZE - 1)) == 0, "wavetable phase indexing needs a power-of-two size");
+_Static_assert((long)WAVETABLE_SAMPLE_RATE == (long)SYNTH_SAMPLE_RATE,
+               "tMwavetables.h was generated for another sample rate - rerun tMwavegen");
 
 // MIDI event structure
 typedef struct {
@@ -59,13 +198,249 @@ typedef struct {
     uint8_t velocity;
 } MIDIEvent;
 
+// Recorded note - a paired note-on/note-off
+typedef struct {
+    uint32_t start;         // Note-on tick within the track's loop
+    uint32_t length;        // Ticks held (0 = still held while recording)
+    uint8_t note;
+    uint8_t velocity;
+} MIDINote;
+
+// Take - one overdub pass, a slice of the shared take arena
+typedef struct {
+    uint32_t first;         // First note in takeArena
+    uint32_t count;
+} Take;
+
 // Track structure
 typedef struct {
-    MIDIEvent events[MAX_EVENTS_PER_TRACK];
+    MIDINote notes[MAX_NOTES_PER_TRACK];
+    int noteCount;
+    MIDIEvent events[MAX_EVENTS_PER_TRACK];  // Playback index - wire events built from notes[]
     int eventCount;
     int program;
+    int loopBars;           // Track's own loop length in bars (0 = follow session loop)
+    uint32_t playPos;       // Playback cursor within the track's own loop
+    int playIndex;          // First event at or after playPos
+    bool dirty;             // notes[], quantize or loop length changed - rebuild events[] and re-seek
+    uint8_t quantizeGrid;   // Index into quantizeGridTicks (0 = off, last = groove)
+    uint8_t quantizeSwing;  // Index into quantizeSwingPercent
+    uint8_t quantizeStrength;  // Index into quantizeStrengthPercent
+    int8_t transpose;       // Semitones applied at playback
+    int8_t velocityTrim;    // Velocity scale in 1/8 steps (0 = unity, -6 to +8)
+    uint64_t barSounding[MAX_LOOP_BARS][2];   // Chase: pitches sounding at each bar line,
+    uint8_t barVelocity[MAX_LOOP_BARS][128];  // the velocity each was started with
+    int barIndex[MAX_LOOP_BARS];              // and the bar's first event
+    uint8_t volume;         // Mix: CC7 (sent as 0 while muted or another track is soloed, saved as is)
+    uint8_t pan;            // Mix: CC10 (64 = centre)
+    bool mute;
+    bool solo;
+    Take takes[MAX_TAKES_PER_TRACK];  // Overdub passes, oldest first
+    int takeCount;
+    uint16_t compMask[MAX_LOOP_BARS];  // Per bar: takes that play (bit k = takes[k])
 } MIDITrack;
 
+// Undo snapshot of a track's editable state. Notes are a list of shared,
+// immutable chunks; settings and take headers are copied (takes point into
+// the append-only arena, so their notes are shared as they are).
+typedef struct {
+    uint16_t chunks[UNDO_CHUNKS_PER_TRACK];
+    int noteCount;
+    int loopBars;
+    uint8_t quantizeGrid;
+    uint8_t quantizeSwing;
+    uint8_t quantizeStrength;
+    int8_t transpose;
+    int8_t velocityTrim;
+    Take takes[MAX_TAKES_PER_TRACK];
+    int takeCount;
+    uint16_t compMask[MAX_LOOP_BARS];
+} TrackSnapshot;
+
+// Undo entry - one edit of one track
+typedef struct {
+    int track;
+    TrackSnapshot before;
+    TrackSnapshot after;
+} UndoEntry;
+
+// Native synth voice. Voices in use are linked into one of two intrusive LRU
+// lists (held, released), oldest first; stealing takes the head of the first
+// non-empty list, so a released voice is always stolen before a held one.
+// Everything the render loop needs is precomputed into the voice at note-on
+// from its patch (or drum sound), so the per-sample path is multiply-adds.
+typedef struct {
+    const float *tableA;    // Band-limited wavetables for the note's octave
+    const float *tableB;
+    uint32_t phaseA;        // Oscillator phases (full scale = one cycle)
+    uint32_t phaseB;
+    uint32_t incA;          // Phase steps per sample
+    uint32_t incB;
+    float levelA;           // Oscillator mix x velocity
+    float levelB;
+    float noiseLevel;       // Drums: white noise mixed with the oscillators
+    uint32_t noise;         // Noise generator state
+    float sweep;            // Drums: pitch above base (ratio - 1), decaying
+    float sweepCoef;
+    float env;              // Amplitude envelope level
+    float attackStep;       // Linear attack per sample
+    float decayCoef;        // Exponential decay toward sustain per sample
+    float sustain;
+    float releaseCoef;
+    float cutoff;           // Filter cutoff in Hz before envelope
+    float filterEnv;        // Octaves added to the cutoff at envelope peak
+    float damping;          // Filter damping (2 = none, lower = resonant)
+    float low;              // Filter integrator states
+    float band;
+    float svfG;             // Filter coefficients reached at the end of the last block
+    float svfA1;
+    float svfA2;
+    uint8_t filterMode;     // FILTER_LOW, FILTER_BAND, FILTER_HIGH or FILTER_OFF
+    bool attacking;
+    bool finished;          // Envelope has decayed; freed after this pass
+    const int16_t *sample;  // SoundFont voice: sample data in the mapping (NULL = oscillators)
+    uint64_t samplePos;     // 32.32 fixed-point frame position
+    uint64_t sampleInc;
+    uint32_t sampleEnd;     // Frames, relative to sample
+    uint32_t loopStart;
+    uint32_t loopEnd;
+    uint8_t loopMode;       // SF2 sampleModes: 0 none, 1 loop, 3 loop until released
+    uint8_t sampleStride;   // Interleaved channels (only the first is played)
+    uint16_t startDelay;    // Frames of the first block before the note starts
+    uint16_t releaseDelay;  // Frames a released voice still holds (note-off offset)
+    uint8_t channel;
+    uint8_t note;
+    uint8_t list;           // VOICE_HELD or VOICE_RELEASED
+    int8_t prev;            // LRU links (-1 = none)
+    int8_t next;
+} SynthVoice;
+
+// Parametric patch - two wavetable oscillators into a resonant filter with a
+// shared ADSR envelope. 12 bytes per GM program (the 16-bit field leads, so
+// there is no padding).
+typedef struct {
+    int16_t detuneB;        // B pitch offset in cents
+    uint8_t waveA;          // Wavetable families (WAVE_*)
+    uint8_t waveB;
+    uint8_t mixB;           // Level of B against A (0 = A only, 255 = B only)
+    uint8_t cutoff;         // Low-pass cutoff in semitones above the played note
+    uint8_t resonance;      // 0-255
+    int8_t filterEnv;       // Semitones added to the cutoff at envelope peak
+    uint8_t attack;         // Times coded as 1 ms * 2^(t/16) (0 = 1 ms, 160 = 1 s)
+    uint8_t decay;
+    uint8_t sustain;        // Sustain level 0-255
+    uint8_t release;
+} SynthPatch;
+_Static_assert(sizeof(SynthPatch) == 12, "SynthPatch is no longer 12 bytes - update its comments");
+
+// GM drum sound - a pitched body with a pitch sweep plus noise, one filter
+typedef struct {
+    uint8_t pitch;          // Body pitch (MIDI note)
+    uint8_t body;           // Body level 0-255
+    uint8_t noise;          // Noise level 0-255
+    uint8_t sweep;          // Body starts this many semitones sharp
+    uint8_t decay;          // Time code as in SynthPatch
+    uint8_t cutoff;         // Filter cutoff (MIDI note)
+    uint8_t filterMode;     // FILTER_LOW, FILTER_BAND or FILTER_HIGH
+} DrumSound;
+
+// GM drum kit (channel 10 program) - a variation of the one drum map
+typedef struct {
+    uint8_t program;        // First program using this kit
+    int8_t tune;            // Semitones
+    int8_t decay;           // Added to every decay code
+    int8_t cutoff;          // Semitones added to every cutoff
+} DrumKit;
+
+// SoundFont zone - one sample with its key / velocity range, resolved from
+// the preset and instrument generators when the bank is loaded
+typedef struct {
+    uint32_t start;         // Frames into the smpl chunk
+    uint32_t end;
+    uint32_t loopStart;
+    uint32_t loopEnd;
+    uint32_t sampleRate;
+    int16_t tune;           // Cents (coarse, fine and the sample's pitch correction)
+    int16_t attenuation;    // Centibels
+    int16_t release;        // Volume envelope release in timecents
+    uint8_t keyLo, keyHi;
+    uint8_t velLo, velHi;
+    uint8_t rootKey;
+    uint8_t loopMode;
+} SF2Zone;
+
+// Zones of one preset (a range of sf2Zones)
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+} SF2Preset;
+
+// Mixer strip of one channel. Controllers arrive as MIDI CCs; the gains they
+// imply are targets, approached a little every control block.
+typedef struct {
+    float reverb;           // Send levels (CC91, CC93, CC94), 0-1
+    float chorus;
+    float delay;
+    uint8_t volume;         // CC7
+    uint8_t pan;            // CC10 (64 = centre)
+    uint8_t expression;     // CC11
+    float targetLevel;      // Volume x expression (sends are post-fader)
+    float targetL;          // Level with constant-power pan
+    float targetR;
+    float level;            // Smoothed gains reached at the end of the last block
+    float gainL;
+    float gainR;
+    float meter;            // Peak with decay (render thread)
+} SynthStrip;
+
+// Drum sample - 16-bit PCM frames inside a mapped WAV file
+typedef struct {
+    const int16_t *frames;
+    uint32_t frameCount;
+    uint32_t sampleRate;
+    uint8_t channels;
+    const void *map;
+    size_t mapSize;
+} DrumSample;
+
+// Message from the sequencer / key handler to the render thread (MIDI bytes).
+// hostTime 0 applies at the start of the next block; otherwise the message
+// takes effect at that frame of whichever block contains it.
+typedef struct {
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+    uint64_t hostTime;
+} SynthMessage;
+
+// Retrospective capture entry - every played note, recorded or not
+typedef struct {
+    uint64_t machTime;      // When it was played
+    uint64_t songTick;      // Song position when played (UINT64_MAX if clock was stopped)
+    uint8_t status;         // Note on (0x90) or note off (0x80)
+    uint8_t note;
+    uint8_t velocity;
+    uint8_t channel;
+} CaptureEvent;
+
+// Tempo map segment - constant tempo (startBPM == endBPM) or linear ramp to endBPM
+typedef struct {
+    uint32_t tick;          // Segment start tick (segments sorted, first at tick 0)
+    double startBPM;
+    double endBPM;          // Tempo reached at the next segment (or loop end)
+} TempoSegment;
+
+// Precomputed tempo table node - constant tempo from tick until the next node.
+// Times are in mach ticks; per-node rates are fixed-point reciprocals so that
+// conversions are a multiply and shift with no division.
+typedef struct {
+    uint32_t tick;          // Node start tick
+    uint32_t microsPerBeat; // For the SMF tempo track
+    uint64_t mach;          // Cumulative mach time from loop start to this node
+    uint64_t machPerTick;   // 32.32 fixed point mach ticks per MIDI tick
+    uint64_t ticksPerMach;  // 0.64 fixed point reciprocal of machPerTick (rounded up)
+} TempoNode;
+
 // Direct keycode-to-note lookup table (value = noteOffset + 1, 0 = unmapped)
 // O(1) lookup indexed by macOS virtual keycode
 // Note keys: z x c v b n m (bottom), a s d f g h j k l (middle), q w e r t y u i o p (top)
@@ -121,12 +496,27 @@ static const uint16_t LBRACKET_KEYCODE = 0x21;
 static const uint16_t RBRACKET_KEYCODE = 0x1E;
 static const uint16_t SLASH_KEYCODE = 0x2C;
 static const uint16_t DELETE_KEYCODE = 0x33;      // Backspace/Delete
-static const uint16_t BACKTICK_KEYCODE = 0x32;    // ` key for quantize toggle
+static const uint16_t BACKTICK_KEYCODE = 0x32;    // ` key for quantize grid/swing
 static const uint16_t BACKSLASH_KEYCODE = 0x2A;   // \ key for panic (all notes off)
 static const uint16_t RIGHT_ARROW_KEYCODE = 0x7C;
 static const uint16_t LEFT_ARROW_KEYCODE = 0x7B;
 static const uint16_t DOWN_ARROW_KEYCODE = 0x7D;
 static const uint16_t UP_ARROW_KEYCODE = 0x7E;
+static const uint16_t SEMICOLON_KEYCODE = 0x29;   // ; key for time signature
+static const uint16_t COMMA_KEYCODE = 0x2B;       // , key for loop length down
+static const uint16_t PERIOD_KEYCODE = 0x2F;      // . key for loop length up
+static const uint16_t QUOTE_KEYCODE = 0x27;       // ' key for capture commit
+static const uint16_t HOME_KEYCODE = 0x73;        // Locate to region start / bar 1
+static const uint16_t END_KEYCODE = 0x77;         // Toggle loop region
+static const uint16_t PAGE_UP_KEYCODE = 0x74;     // Locate one bar back
+static const uint16_t PAGE_DOWN_KEYCODE = 0x79;   // Locate one bar forward
+static const uint16_t RETURN_KEYCODE = 0x24;      // Undo (Shift: redo)
+static const uint16_t F1_KEYCODE = 0x7A;          // Track volume down
+static const uint16_t F2_KEYCODE = 0x78;          // Track volume up
+static const uint16_t F3_KEYCODE = 0x63;          // Track pan left
+static const uint16_t F4_KEYCODE = 0x76;          // Track pan right
+static const uint16_t F5_KEYCODE = 0x60;          // Track mute
+static const uint16_t F6_KEYCODE = 0x61;          // Track solo
 
 // General MIDI program names
 static const char* gmNames[] = {
@@ -160,12 +550,282 @@ static const char* gmNames[] = {
     "Applause", "Gunshot"
 };
 
+// Native synth patches for the 128 GM programs
+enum { FILTER_LOW, FILTER_BAND, FILTER_HIGH, FILTER_OFF };
+static const SynthPatch gmPatches[128] = {
+    // detune waveA        waveB          mixB cut  res  fenv att  dec  sus  rel
+    {     4, WAVE_SAW,     WAVE_TRIANGLE, 128,  24,  20,  24,   0, 176,   0, 112 },  // 0 Acoustic Grand Piano
+    {     4, WAVE_SAW,     WAVE_TRIANGLE, 128,  36,  20,  24,   0, 176,   0, 112 },  // 1 Bright Acoustic Piano
+    {     4, WAVE_SAW,     WAVE_SQUARE,   128,  30,  20,  24,   0, 176,   0, 112 },  // 2 Electric Grand Piano
+    {    24, WAVE_SAW,     WAVE_TRIANGLE, 128,  24,  20,  24,   0, 176,   0, 112 },  // 3 Honky-tonk Piano
+    {  1200, WAVE_TRIANGLE, WAVE_TRIANGLE,  40,  30,  20,  24,   0, 168,   0, 112 },  // 4 Electric Piano 1
+    {     0, WAVE_TRIANGLE, WAVE_SAW,       60,  24,  20,  24,   0, 168,   0, 112 },  // 5 Electric Piano 2
+    {  1200, WAVE_PULSE,   WAVE_PULSE,     60,  60,  40,  24,   0, 144,   0, 112 },  // 6 Harpsichord
+    {     4, WAVE_PULSE,   WAVE_SQUARE,   128,  24, 120,  40,   0, 128,   0, 112 },  // 7 Clavi
+    {  1200, WAVE_TRIANGLE, WAVE_TRIANGLE,  96,  36,  10,  12,   0, 152,   0, 144 },  // 8 Celesta
+    {  1200, WAVE_TRIANGLE, WAVE_TRIANGLE,  96,  60,  10,  12,   0, 144,   0, 144 },  // 9 Glockenspiel
+    {  1200, WAVE_TRIANGLE, WAVE_TRIANGLE,  64,  36,  10,  12,   0, 136,   0, 144 },  // 10 Music Box
+    {     0, WAVE_TRIANGLE, WAVE_TRIANGLE,  64,  36,  10,  12,   0, 168,   0, 144 },  // 11 Vibraphone
+    {  2400, WAVE_TRIANGLE, WAVE_TRIANGLE,  96,  36,  10,  12,   0, 120,   0, 144 },  // 12 Marimba
+    {  2400, WAVE_TRIANGLE, WAVE_TRIANGLE,  96,  60,  10,  12,   0, 104,   0, 144 },  // 13 Xylophone
+    {  1900, WAVE_SAW,     WAVE_TRIANGLE,  96,  36,  10,  12,   0, 184,   0, 144 },  // 14 Tubular Bells
+    {     5, WAVE_SAW,     WAVE_PULSE,    128,  30,  10,  12,   0, 152,   0, 144 },  // 15 Dulcimer
+    {     6, WAVE_SQUARE,  WAVE_SAW,      112,  48,   0,   0,  16,  96, 255,  96 },  // 16 Drawbar Organ
+    {     6, WAVE_SQUARE,  WAVE_SAW,      112,  48,   0,  24,  16, 112, 160,  96 },  // 17 Percussive Organ
+    {     6, WAVE_SAW,     WAVE_SQUARE,   112,  48,  40,   0,  16,  96, 255,  96 },  // 18 Rock Organ
+    {  1200, WAVE_SQUARE,  WAVE_SAW,      128,  60,   0,   0,  16,  96, 255, 144 },  // 19 Church Organ
+    {     6, WAVE_PULSE,   WAVE_SAW,      112,  30,   0,   0,  16,  96, 255,  96 },  // 20 Reed Organ
+    {    14, WAVE_SAW,     WAVE_SAW,      112,  30,  20,   0,  16,  96, 255,  96 },  // 21 Accordion
+    {     6, WAVE_SQUARE,  WAVE_SQUARE,     0,  24,  60,   0,  48,  96, 255,  96 },  // 22 Harmonica
+    {    10, WAVE_SAW,     WAVE_SAW,      112,  30,  20,   0,  16,  96, 255,  96 },  // 23 Tango Accordion
+    {     5, WAVE_TRIANGLE, WAVE_SAW,       64,  24,  60,  30,   0, 160,   0, 112 },  // 24 Acoustic Guitar (nylon)
+    {     5, WAVE_SAW,     WAVE_PULSE,    128,  30,  60,  30,   0, 160,   0, 112 },  // 25 Acoustic Guitar (steel)
+    {     5, WAVE_TRIANGLE, WAVE_PULSE,    128,  14,  20,  30,   0, 160,   0, 112 },  // 26 Electric Guitar (jazz)
+    {     5, WAVE_SAW,     WAVE_PULSE,    128,  30,  40,  30,   0, 160,   0, 112 },  // 27 Electric Guitar (clean)
+    {     5, WAVE_SAW,     WAVE_PULSE,    128,  10,  60,  30,   0,  96,   0, 112 },  // 28 Electric Guitar (muted)
+    {     5, WAVE_SAW,     WAVE_SQUARE,   128,  40,  20,  30,   0, 128, 180, 112 },  // 29 Overdriven Guitar
+    {     5, WAVE_SQUARE,  WAVE_SAW,      128,  50,  30,  30,   0, 128, 200, 112 },  // 30 Distortion Guitar
+    {  1900, WAVE_TRIANGLE, WAVE_TRIANGLE, 128,  60,  60,  30,   0, 160,   0, 112 },  // 31 Guitar Harmonics
+    {     0, WAVE_TRIANGLE, WAVE_SAW,       40,   4,  20,  24,   0, 144,  64,  96 },  // 32 Acoustic Bass
+    {     0, WAVE_SAW,     WAVE_SQUARE,    96,   8,  40,  24,   0, 144,  64,  96 },  // 33 Electric Bass (finger)
+    {     0, WAVE_SAW,     WAVE_SQUARE,    96,  14,  90,  36,   0, 144,  64,  96 },  // 34 Electric Bass (pick)
+    {     0, WAVE_TRIANGLE, WAVE_SAW,       64,  10,  90,  24,   0, 144, 160,  96 },  // 35 Fretless Bass
+    {     0, WAVE_SAW,     WAVE_SQUARE,    96,   6, 140,  40,   0, 112,  64,  96 },  // 36 Slap Bass 1
+    {     0, WAVE_SAW,     WAVE_SQUARE,    96,   6, 160,  48,   0, 104,  64,  96 },  // 37 Slap Bass 2
+    {     8, WAVE_SAW,     WAVE_SAW,       96,   6, 180,  48,   0, 144,  64,  96 },  // 38 Synth Bass 1
+    {     0, WAVE_SQUARE,  WAVE_SAW,       96,   6, 200,  60,   0, 144,  64,  96 },  // 39 Synth Bass 2
+    {    10, WAVE_SAW,     WAVE_SAW,      128,  30,  20,   6, 112, 128, 220, 144 },  // 40 Violin
+    {    10, WAVE_SAW,     WAVE_SAW,      128,  30,  20,   6, 112, 128, 220, 144 },  // 41 Viola
+    {    10, WAVE_SAW,     WAVE_SAW,      128,  30,  20,   6, 112, 128, 220, 144 },  // 42 Cello
+    {    10, WAVE_SAW,     WAVE_SAW,      128,  30,  20,   6, 112, 128, 220, 144 },  // 43 Contrabass
+    {    10, WAVE_SAW,     WAVE_SAW,      128,  30,  20,   6, 112, 128, 200, 144 },  // 44 Tremolo Strings
+    {    10, WAVE_SAW,     WAVE_SAW,      128,  30,  20,   6,   0, 112,   0, 104 },  // 45 Pizzicato Strings
+    {  1200, WAVE_TRIANGLE, WAVE_TRIANGLE,  64,  30,  20,   6,   0, 160,   0, 144 },  // 46 Orchestral Harp
+    {     0, WAVE_TRIANGLE, WAVE_TRIANGLE, 128,  10,  20,   6,   0, 152,   0, 128 },  // 47 Timpani
+    {    14, WAVE_SAW,     WAVE_SAW,      160,  24,  10,   6, 128, 128, 220, 160 },  // 48 String Ensemble 1
+    {    14, WAVE_SAW,     WAVE_SAW,      160,  24,  10,   6, 128, 128, 220, 160 },  // 49 String Ensemble 2
+    {    14, WAVE_SAW,     WAVE_SAW,      160,  24,  10,   6, 128, 128, 220, 160 },  // 50 Synth Strings 1
+    {    14, WAVE_SAW,     WAVE_SAW,      160,  24,  10,   6, 128, 128, 220, 160 },  // 51 Synth Strings 2
+    {    14, WAVE_TRIANGLE, WAVE_SAW,       80,  12,  60,   6, 128, 128, 220, 160 },  // 52 Choir Aahs
+    {     8, WAVE_TRIANGLE, WAVE_TRIANGLE, 160,  10,  10,   6, 128, 128, 220, 160 },  // 53 Voice Oohs
+    {    14, WAVE_PULSE,   WAVE_SAW,      160,  24,  80,   6, 128, 128, 220, 160 },  // 54 Synth Voice
+    {   700, WAVE_SAW,     WAVE_SQUARE,   160,  40,  10,   6,   0, 120,   0, 160 },  // 55 Orchestra Hit
+    {     6, WAVE_SAW,     WAVE_PULSE,     80,  20,  40,  24,  80, 128, 200, 112 },  // 56 Trumpet
+    {     6, WAVE_SAW,     WAVE_SQUARE,    80,   8,  40,  24,  80, 128, 200, 112 },  // 57 Trombone
+    { -1200, WAVE_SAW,     WAVE_SQUARE,    80,   4,  40,  24,  80, 128, 200, 112 },  // 58 Tuba
+    {     6, WAVE_SQUARE,  WAVE_SQUARE,    80,  10,  80,  24,  80, 128, 200, 112 },  // 59 Muted Trumpet
+    {     6, WAVE_TRIANGLE, WAVE_SAW,       64,   8,  40,  24,  96, 128, 200, 112 },  // 60 French Horn
+    {    14, WAVE_SAW,     WAVE_SQUARE,   160,  12,  40,  24,  80, 128, 200, 112 },  // 61 Brass Section
+    {     6, WAVE_SAW,     WAVE_SQUARE,    80,  12, 100,  36,  32, 128, 200, 112 },  // 62 Synth Brass 1
+    {    12, WAVE_SAW,     WAVE_SQUARE,    80,  12,  80,  30,  80, 128, 200, 112 },  // 63 Synth Brass 2
+    {     4, WAVE_SQUARE,  WAVE_SAW,       96,  24,  50,  12,  64, 128, 210, 104 },  // 64 Soprano Sax
+    {     4, WAVE_SQUARE,  WAVE_SAW,       96,  20,  50,  12,  64, 128, 210, 104 },  // 65 Alto Sax
+    {     4, WAVE_SQUARE,  WAVE_SAW,       96,  14,  50,  12,  64, 128, 210, 104 },  // 66 Tenor Sax
+    { -1200, WAVE_SQUARE,  WAVE_SAW,       96,  10,  50,  12,  64, 128, 210, 104 },  // 67 Baritone Sax
+    {     4, WAVE_PULSE,   WAVE_SQUARE,    96,  12,  40,  12,  64, 128, 210, 104 },  // 68 Oboe
+    {     4, WAVE_PULSE,   WAVE_SAW,       96,  16,  50,  12,  64, 128, 210, 104 },  // 69 English Horn
+    { -1200, WAVE_PULSE,   WAVE_SAW,       96,   8,  50,  12,  64, 128, 210, 104 },  // 70 Bassoon
+    {     4, WAVE_SQUARE,  WAVE_TRIANGLE,  64,  20,  50,  12,  64, 128, 210, 104 },  // 71 Clarinet
+    {  1200, WAVE_TRIANGLE, WAVE_TRIANGLE,  64,  40,   0,   6,  48, 128, 220, 112 },  // 72 Piccolo
+    {  1200, WAVE_TRIANGLE, WAVE_TRIANGLE,  64,  24,   0,   6,  80, 128, 220, 112 },  // 73 Flute
+    {  1200, WAVE_TRIANGLE, WAVE_TRIANGLE,  64,  20,   0,   6,  96, 128, 220, 112 },  // 74 Recorder
+    {     0, WAVE_TRIANGLE, WAVE_TRIANGLE, 128,  12,   0,   6,  80, 128, 220, 112 },  // 75 Pan Flute
+    {  1200, WAVE_TRIANGLE, WAVE_TRIANGLE,  64,  16,   0,   6, 112, 128, 220, 112 },  // 76 Blown Bottle
+    {  1200, WAVE_TRIANGLE, WAVE_TRIANGLE,  64,  20,   0,   6,  96, 128, 220, 112 },  // 77 Shakuhachi
+    {  1200, WAVE_TRIANGLE, WAVE_TRIANGLE,  32,  14,   0,   6,  80, 128, 220, 112 },  // 78 Whistle
+    {  1200, WAVE_TRIANGLE, WAVE_TRIANGLE,   0,  10,   0,   6,  64, 128, 220, 112 },  // 79 Ocarina
+    {     6, WAVE_SQUARE,  WAVE_SQUARE,   128,  36,  80,  18,  16, 128, 230, 104 },  // 80 Lead 1 (square)
+    {     7, WAVE_SAW,     WAVE_SAW,      128,  36,  80,  18,  16, 128, 230, 104 },  // 81 Lead 2 (sawtooth)
+    {  1200, WAVE_TRIANGLE, WAVE_SQUARE,    96,  36,  80,  18,  16, 128, 230, 104 },  // 82 Lead 3 (calliope)
+    {     8, WAVE_PULSE,   WAVE_TRIANGLE, 128,  36,  80,  40,  16, 104, 180, 104 },  // 83 Lead 4 (chiff)
+    {     8, WAVE_SAW,     WAVE_SQUARE,   128,  24, 140,  18,  16, 128, 230, 104 },  // 84 Lead 5 (charang)
+    {     8, WAVE_TRIANGLE, WAVE_SAW,       80,  24,  80,  18,  64, 128, 230, 104 },  // 85 Lead 6 (voice)
+    {   700, WAVE_SAW,     WAVE_SQUARE,   160,  36,  80,  18,  16, 128, 230, 104 },  // 86 Lead 7 (fifths)
+    { -1200, WAVE_SAW,     WAVE_SQUARE,   160,  36, 100,  18,  16, 128, 230, 104 },  // 87 Lead 8 (bass+lead)
+    {    12, WAVE_TRIANGLE, WAVE_SAW,       80,  30,  30,  12, 160, 160, 220, 176 },  // 88 Pad 1 (new age)
+    {    12, WAVE_SAW,     WAVE_SAW,      160,  14,  10,  12, 160, 160, 220, 176 },  // 89 Pad 2 (warm)
+    {    10, WAVE_SAW,     WAVE_SQUARE,   160,  24,  30,  24, 160, 160, 220, 176 },  // 90 Pad 3 (polysynth)
+    {    12, WAVE_TRIANGLE, WAVE_SAW,       96,  18,  30,  12, 176, 160, 220, 176 },  // 91 Pad 4 (choir)
+    {    12, WAVE_SAW,     WAVE_TRIANGLE, 160,  20,  60,  12, 176, 160, 220, 176 },  // 92 Pad 5 (bowed)
+    {  1900, WAVE_PULSE,   WAVE_SAW,      160,  20, 140,  12, 160, 160, 220, 176 },  // 93 Pad 6 (metallic)
+    {  1200, WAVE_TRIANGLE, WAVE_TRIANGLE, 160,  20,  30,  12, 184, 160, 220, 192 },  // 94 Pad 7 (halo)
+    {    12, WAVE_SAW,     WAVE_SAW,      160,  20, 160,  60, 176, 192, 220, 176 },  // 95 Pad 8 (sweep)
+    {  2400, WAVE_PULSE,   WAVE_TRIANGLE,  96,  30,  60,  24, 120, 144,  80, 176 },  // 96 FX 1 (rain)
+    {    12, WAVE_SAW,     WAVE_SAW,       96,  30,  60,  24, 160, 176, 160, 176 },  // 97 FX 2 (soundtrack)
+    {  2400, WAVE_TRIANGLE, WAVE_TRIANGLE,  96,  30,  60,  24,   0, 176,   0, 176 },  // 98 FX 3 (crystal)
+    {   700, WAVE_SAW,     WAVE_PULSE,     96,  30,  60,  24,  96, 176, 160, 176 },  // 99 FX 4 (atmosphere)
+    {  1200, WAVE_TRIANGLE, WAVE_SAW,       96,  60, 100,  24,   0, 168,  60, 176 },  // 100 FX 5 (brightness)
+    {  -500, WAVE_SQUARE,  WAVE_SAW,       96,  30, 180, -24, 120, 176, 160, 176 },  // 101 FX 6 (goblins)
+    {  1200, WAVE_TRIANGLE, WAVE_TRIANGLE,  96,  30,  60,  24,  64, 176, 160, 200 },  // 102 FX 7 (echoes)
+    { -1200, WAVE_SAW,     WAVE_SQUARE,    96,  30, 200,  48, 120, 176, 160, 176 },  // 103 FX 8 (sci-fi)
+    {  1200, WAVE_SAW,     WAVE_SAW,      128,  30, 140,  24,   0, 160,  40, 112 },  // 104 Sitar
+    {  1200, WAVE_PULSE,   WAVE_PULSE,    128,  50,  70,  24,   0, 120,  40, 112 },  // 105 Banjo
+    {     6, WAVE_PULSE,   WAVE_SAW,      128,  40, 100,  24,   0, 112,  40, 112 },  // 106 Shamisen
+    {  1200, WAVE_TRIANGLE, WAVE_PULSE,    128,  40,  70,  24,   0, 144,  40, 112 },  // 107 Koto
+    {     0, WAVE_TRIANGLE, WAVE_TRIANGLE,   0,  24,  70,  24,   0, 120,  40, 112 },  // 108 Kalimba
+    { -1200, WAVE_SAW,     WAVE_SQUARE,   128,  30,  70,  24,  48, 128, 220, 112 },  // 109 Bag Pipe
+    {     6, WAVE_SAW,     WAVE_SAW,      128,  24,  30,  24,  64, 128, 210, 112 },  // 110 Fiddle
+    {     6, WAVE_SQUARE,  WAVE_SAW,      128,  26,  60,  24,  48, 128, 200, 112 },  // 111 Shanai
+    {  2700, WAVE_TRIANGLE, WAVE_TRIANGLE, 128,  60,  30,  30,   0, 168,   0,  96 },  // 112 Tinkle Bell
+    {  1900, WAVE_SQUARE,  WAVE_TRIANGLE, 128,  40,  30,  30,   0,  88,   0,  96 },  // 113 Agogo
+    {  1200, WAVE_TRIANGLE, WAVE_SAW,      128,  40,  60,  30,   0, 136,   0,  96 },  // 114 Steel Drums
+    {   700, WAVE_PULSE,   WAVE_TRIANGLE, 128,  30,  30,  30,   0,  72,   0,  96 },  // 115 Woodblock
+    {     0, WAVE_TRIANGLE, WAVE_TRIANGLE, 128,   8,  30,  24,   0, 112,   0,  96 },  // 116 Taiko Drum
+    {     0, WAVE_TRIANGLE, WAVE_SAW,      128,  10,  30,  36,   0, 120,   0,  96 },  // 117 Melodic Tom
+    {     0, WAVE_TRIANGLE, WAVE_SQUARE,   128,  12,  30,  48,   0, 100,   0,  96 },  // 118 Synth Drum
+    {    50, WAVE_SAW,     WAVE_SAW,      128,  50,  30,  30, 176, 160,   0,  96 },  // 119 Reverse Cymbal
+    {  1900, WAVE_SAW,     WAVE_SQUARE,   128,  60,  80,  36,  64,  72,   0, 160 },  // 120 Guitar Fret Noise
+    {   100, WAVE_SAW,     WAVE_SAW,      128,  20, 140,  36,  96, 160, 160, 160 },  // 121 Breath Noise
+    {   300, WAVE_SAW,     WAVE_SAW,      128,  40,  40,  36, 144, 160, 160, 160 },  // 122 Seashore
+    {  1900, WAVE_TRIANGLE, WAVE_TRIANGLE, 128,  40, 120,  36,  64,  96,   0, 160 },  // 123 Bird Tweet
+    {  1200, WAVE_SQUARE,  WAVE_SQUARE,   128,  30,  80,  36,   0, 160, 255, 160 },  // 124 Telephone Ring
+    { -1200, WAVE_SAW,     WAVE_SAW,      128,  40,  60,  36, 160, 160, 160, 160 },  // 125 Helicopter
+    {   800, WAVE_SAW,     WAVE_SAW,      128,  40,  40,  36, 112, 160, 160, 160 },  // 126 Applause
+    { -2400, WAVE_SAW,     WAVE_SQUARE,   128,  40, 100, -36,   0, 184,   0, 160 },  // 127 Gunshot
+};
+
+// GM percussion map (notes 35-81) for channel 10
+static const DrumSound gmDrums[DRUM_NOTE_COUNT] = {
+    // pitch body noise sweep decay cutoff mode
+    { 28, 255,  20, 24, 120,  60, FILTER_LOW  },  // 35 Acoustic Bass Drum
+    { 31, 255,  24, 24, 112,  64, FILTER_LOW  },  // 36 Bass Drum 1
+    { 72, 160, 120, 12,  56, 100, FILTER_BAND },  // 37 Side Stick
+    { 52, 140, 220, 12, 104,  96, FILTER_LOW  },  // 38 Acoustic Snare
+    { 60,  40, 240,  0,  96,  90, FILTER_BAND },  // 39 Hand Clap
+    { 55, 120, 240, 16,  96, 100, FILTER_LOW  },  // 40 Electric Snare
+    { 41, 255,  30, 12, 128,  60, FILTER_LOW  },  // 41 Low Floor Tom
+    { 90,   0, 200,  0,  72, 118, FILTER_HIGH },  // 42 Closed Hi-Hat
+    { 43, 255,  30, 12, 128,  62, FILTER_LOW  },  // 43 High Floor Tom
+    { 90,   0, 180,  0,  80, 115, FILTER_HIGH },  // 44 Pedal Hi-Hat
+    { 45, 255,  30, 12, 124,  64, FILTER_LOW  },  // 45 Low Tom
+    { 90,   0, 200,  0, 136, 118, FILTER_HIGH },  // 46 Open Hi-Hat
+    { 47, 255,  30, 12, 124,  66, FILTER_LOW  },  // 47 Low-Mid Tom
+    { 50, 255,  30, 12, 120,  68, FILTER_LOW  },  // 48 Hi-Mid Tom
+    { 80,   0, 220,  0, 176, 112, FILTER_HIGH },  // 49 Crash Cymbal 1
+    { 52, 255,  30, 12, 120,  70, FILTER_LOW  },  // 50 High Tom
+    { 84,  60, 160,  0, 168, 120, FILTER_HIGH },  // 51 Ride Cymbal 1
+    { 80,   0, 230,  0, 160, 108, FILTER_BAND },  // 52 Chinese Cymbal
+    { 88, 160, 100,  0, 152, 124, FILTER_HIGH },  // 53 Ride Bell
+    { 90,   0, 200,  0, 104, 124, FILTER_HIGH },  // 54 Tambourine
+    { 82,   0, 220,  0, 144, 116, FILTER_HIGH },  // 55 Splash Cymbal
+    { 80, 220,  10,  0, 104,  90, FILTER_BAND },  // 56 Cowbell
+    { 78,   0, 220,  0, 176, 110, FILTER_HIGH },  // 57 Crash Cymbal 2
+    { 70,  60, 200,  0, 152, 100, FILTER_BAND },  // 58 Vibraslap
+    { 86,  60, 160,  0, 168, 118, FILTER_HIGH },  // 59 Ride Cymbal 2
+    { 72, 255,  30,  8,  88,  80, FILTER_LOW  },  // 60 Hi Bongo
+    { 67, 255,  30,  8,  96,  76, FILTER_LOW  },  // 61 Low Bongo
+    { 69, 255,  40,  6,  72,  84, FILTER_LOW  },  // 62 Mute Hi Conga
+    { 69, 255,  30,  6, 104,  80, FILTER_LOW  },  // 63 Open Hi Conga
+    { 64, 255,  30,  6, 108,  76, FILTER_LOW  },  // 64 Low Conga
+    { 77, 200,  80,  6, 104,  96, FILTER_BAND },  // 65 High Timbale
+    { 72, 200,  80,  6, 108,  92, FILTER_BAND },  // 66 Low Timbale
+    { 84, 230,   0,  0, 112, 110, FILTER_LOW  },  // 67 High Agogo
+    { 79, 230,   0,  0, 112, 106, FILTER_LOW  },  // 68 Low Agogo
+    { 90,   0, 180,  0,  88, 124, FILTER_HIGH },  // 69 Cabasa
+    { 90,   0, 180,  0,  72, 126, FILTER_HIGH },  // 70 Maracas
+    { 96, 200,   0,  0,  80, 120, FILTER_LOW  },  // 71 Short Whistle
+    { 96, 200,   0,  0, 136, 120, FILTER_LOW  },  // 72 Long Whistle
+    { 70,   0, 200,  0,  80, 100, FILTER_BAND },  // 73 Short Guiro
+    { 70,   0, 200,  0, 120, 100, FILTER_BAND },  // 74 Long Guiro
+    { 88, 255,   0,  0,  64, 110, FILTER_LOW  },  // 75 Claves
+    { 84, 255,  20,  0,  72, 104, FILTER_LOW  },  // 76 Hi Wood Block
+    { 79, 255,  20,  0,  72, 100, FILTER_LOW  },  // 77 Low Wood Block
+    { 70, 200,  40,  4,  72,  90, FILTER_BAND },  // 78 Mute Cuica
+    { 65, 200,  40,  4, 112,  88, FILTER_BAND },  // 79 Open Cuica
+    {100, 200,   0,  0,  80, 124, FILTER_LOW  },  // 80 Mute Triangle
+    {100, 200,   0,  0, 160, 124, FILTER_LOW  },  // 81 Open Triangle
+};
+
+// GM drum kits by program (the highest kit program not above the channel's)
+static const DrumKit gmDrumKits[DRUM_KIT_COUNT] = {
+    {  0,  0,   0,   0 },  // Standard
+    {  8,  0,   8,   0 },  // Room
+    { 16, -2,  16,  -6 },  // Power
+    { 24, -3,   8,   6 },  // Electronic
+    { 25, -5,  24,  10 },  // TR-808
+    { 32,  1,  -8,  -4 },  // Jazz
+    { 40,  0, -16, -12 },  // Brush
+    { 48, -5,  24,  -6 },  // Orchestra
+    { 56, 12,   0,  12 },  // SFX
+};
+
 // Global state - Audio
 static AUGraph graph = NULL;
 static AUNode synthNode = 0;
 static AudioUnit synthUnit = NULL;
+static AUNode mixerNode = 0;          // Input bus 0 = DLS synth, bus 1 = native engine
 static struct termios origTermios;
 
+// Global state - Native synth engine. The render thread owns every voice; the
+// other threads only push messages into the single-producer queue.
+enum { VOICE_HELD, VOICE_RELEASED };
+static SynthVoice synthVoices[SYNTH_VOICES];
+static uint64_t voiceFreeMask = ~0ull;              // Bit set = voice free
+static int8_t voiceMap[MIDI_TRACKS][128];           // Voice sounding (channel, note), -1 = none
+static int8_t voiceListHead[2] = { -1, -1 };        // Oldest voice per LRU list
+static int8_t voiceListTail[2] = { -1, -1 };        // Newest voice per LRU list
+static SynthMessage synthQueue[SYNTH_QUEUE_SIZE];
+static _Atomic uint32_t synthQueueHead = 0;         // Written by the producer only
+static _Atomic uint32_t synthQueueTail = 0;         // Written by the render thread only
+static bool nativeSynth = false;                    // Internal output uses the native engine
+static uint8_t synthPrograms[MIDI_TRACKS];          // Per-channel program (render thread)
+static SynthMessage synthPending[SYNTH_PENDING];    // Timed messages not yet due (render thread)
+static int synthPendingCount = 0;
+static double synthMachPerFrame = 0.0;              // Host ticks per output frame
+static _Atomic uint64_t synthLeadMach = 0;          // Output lead added to every message's time
+static uint64_t synthChannelStamp[MIDI_TRACKS];     // Producer only: keeps each channel's stamps in order
+static DrumSample drumSamples[128];                 // Mapped WAV per drum note (channel 10)
+static SynthStrip synthStrips[MIDI_TRACKS];         // Mixer strips (render thread)
+static _Atomic float synthMeters[MIDI_TRACKS];      // Strip peaks published for the display
+static float synthBus[MIDI_TRACKS][SYNTH_MAX_FRAMES] __attribute__((aligned(64)));  // Per-channel mono mix
+
+// Global state - Render workers. Each pass, channels are dealt to threads;
+// a thread renders every voice of its channels into their buses (no two
+// threads share a bus or a voice), so the result does not depend on how
+// many threads there are.
+static int synthThreadCount = 1;                    // Threads rendering, the render thread included
+static pthread_t synthWorkers[SYNTH_MAX_THREADS];   // [0] unused (the render thread)
+static semaphore_t synthWake[SYNTH_MAX_THREADS];
+static uint16_t synthThreadChannels[SYNTH_MAX_THREADS];
+static UInt32 synthPassFrames = 0;
+static _Atomic int synthPassPending = 0;            // Workers still rendering this pass
+static _Atomic bool synthWorkersQuit = false;
+
+// Global state - Metronome click (render thread). The click is a generator of
+// its own, added to the output after the mixer strips: track mute, solo and
+// volume never reach it, and it takes no voice.
+static const float *clickTable = NULL;
+static uint32_t clickPhase = 0;
+static uint32_t clickInc = 0;
+static float clickLevel = 0.0f;
+static float clickDecay = 0.0f;
+static uint16_t clickDelay = 0;                     // Frames still to wait before it starts
+
+// Global state - Send effects. Every ring is static and the effects run once
+// per control block on the summed sends, so their cost does not depend on
+// how many voices are playing.
+static const uint16_t fxReverbLength[FX_REVERB_LINES] = { 1116, 1277, 1422, 1557, 1687, 1833, 1999, 2143 };
+static float fxReverbRing[FX_REVERB_LINES][FX_REVERB_RING];
+static float fxReverbGain[FX_REVERB_LINES];         // Per-line feedback for the decay time
+static float fxReverbDamp[FX_REVERB_LINES];         // Per-line lowpass state
+static uint32_t fxReverbPos = 0;
+static float fxChorusRing[FX_CHORUS_RING];
+static uint32_t fxChorusPos = 0;
+static float fxChorusPhase = 0.0f;
+static float fxDelayRing[2][FX_DELAY_RING];         // Ping-pong: [0] left, [1] right
+static uint32_t fxDelayPos = 0;
+static _Atomic uint32_t fxDelayFrames = 16538;      // Dotted eighth, set from the tempo
+
+// Global state - SoundFont. The file is mapped, not read: loading parses only
+// the preset tables, and sample pages are faulted in as voices play them.
+static const uint8_t *sf2Map = NULL;
+static size_t sf2MapSize = 0;
+static const int16_t *sf2Samples = NULL;            // smpl chunk inside the mapping
+static uint32_t sf2SampleFrames = 0;
+static SF2Zone *sf2Zones = NULL;
+static uint32_t sf2ZoneCount = 0;
+static SF2Preset sf2Presets[2][128];                // [melodic, drums][program]
+
 // Global state - MIDI Output
 #define MAX_MIDI_DESTINATIONS 10
 static MIDIClientRef midiClient = 0;
@@ -175,11 +835,58 @@ static char midiDestNames[MAX_MIDI_DESTINATIONS][64];
 static int midiDestCount = 0;        // Number of external destinations (excludes internal synth)
 static int selectedOutput = 0;       // 0 = internal synth, 1-9 = external MIDI destinations
 
+// Quantize settings (per track, cycled with ` SHIFT+` SHIFT+\)
+static const uint32_t quantizeGridTicks[QUANTIZE_GRID_COUNT] = {
+    0, TICKS_PER_BEAT, TICKS_PER_BEAT / 2, TICKS_PER_BEAT / 4, TICKS_PER_BEAT / 8,
+    TICKS_PER_BEAT / 3, TICKS_PER_BEAT / 6, 0
+};
+static const char *quantizeGridNames[QUANTIZE_GRID_COUNT] = {
+    "-", "1/4", "1/8", "1/16", "1/32", "1/8T", "1/16T", "GRV"
+};
+static const uint8_t quantizeSwingPercent[QUANTIZE_SWING_COUNT] = { 50, 54, 58, 62, 66, 75 };
+static const uint8_t quantizeStrengthPercent[QUANTIZE_STRENGTH_COUNT] = { 100, 75, 50, 25 };
+
+// Global state - Groove template (extracted from a track with SHIFT+')
+typedef struct {
+    int16_t offset[GROOVE_MAX_SLOTS];   // Average ticks early (-) or late (+) per 16th slot
+    uint8_t velocity[GROOVE_MAX_SLOTS]; // Average velocity per slot (0 = no notes, keep)
+    int slots;                          // 16ths per bar at extraction (0 = no groove)
+} Groove;
+static Groove groove;
+
 // Global state - MIDI
 static MIDITrack tracks[MIDI_TRACKS];
 static int currentChannel = 0;
 static int currentOctave = 3;  // Base octave (C3 = MIDI 36)
 static int8_t heldNoteChannel[128];
+static int16_t openNote[MIDI_TRACKS][128];       // Index of the note being recorded, -1 = none
+static uint64_t openNoteSongTick[MIDI_TRACKS][128];  // Song tick of its note-on (length source)
+
+// Global state - Take arena. Overdub passes are appended once and never edited;
+// comping only changes per-bar masks, so switching takes copies nothing. When
+// the arena fills, takes no track or undo level refers to are squeezed out.
+static MIDINote takeArena[TAKE_ARENA_NOTES];
+static uint32_t takeArenaUsed = 0;
+static uint32_t takeArenaMap[TAKE_ARENA_NOTES];  // Compaction: live take length, then new first
+static int overdubBase = -1;          // Track notes from this index on are the pass in progress
+
+// Global state - Undo history (RETURN / SHIFT+RETURN). Chunks are reference
+// counted; a snapshot shares every chunk that is unchanged since the track's
+// previous snapshot, so each level costs only the chunks its edit touched.
+static MIDINote undoChunkNotes[UNDO_CHUNK_POOL][UNDO_CHUNK_NOTES];
+static uint16_t undoChunkRefs[UNDO_CHUNK_POOL];
+static uint16_t undoChunkFree[UNDO_CHUNK_POOL];  // Stack of unreferenced chunk ids
+static int undoChunkFreeCount = 0;
+static UndoEntry undoHistory[UNDO_LEVELS];       // Ring buffer, oldest at undoFirst
+static int undoFirst = 0;
+static int undoCount = 0;                        // Entries held (applied + redoable)
+static int undoCursor = 0;                       // Entries applied; undo steps back from here
+static TrackSnapshot undoCurrent[MIDI_TRACKS];   // Each track's state as of its last edit
+
+// Global state - Retrospective capture ring (single writer: the event tap callback)
+static CaptureEvent captureRing[CAPTURE_RING_SIZE];
+static uint32_t captureHead = 0;       // Total entries written; slot = head & (size - 1)
+static uint32_t captureCommitted = 0;  // Entries before this were already committed
 
 // Global state - Key tracking (to ignore key repeat)
 static bool keyIsHeld[128] = {false};
@@ -190,20 +897,37 @@ static bool recording = false;
 static bool recordArmed = false;     // Waiting for next beat to start recording
 static bool capsLockOn = false;      // Track Caps Lock state for record sync
 static bool metronomeEnabled = true;
-static bool quantizeEnabled = false; // Global quantize to 16th notes
-static int metronomeBPM = 120;
-static int currentBeat = 0;          // 0 to TOTAL_BEATS-1
+static int metronomeBPM = 120;        // Tempo at loop start
+static int tempoEndBPM = 120;         // Tempo at loop end (== metronomeBPM for constant tempo)
+static int currentBeat = 0;          // 0 to totalBeats-1
 static int recordStartBeat = 0;      // Beat where recording started
 static int beatsRecorded = 0;        // Count of beats recorded
 
 // Global state - Timing (using mach_absolute_time for precision)
 static mach_timebase_info_data_t timebaseInfo;
 static uint64_t clockStartTime = 0;     // When clock started (mach ticks)
-static uint64_t loopStartTime = 0;      // When current loop started
-static uint64_t nanosPerTick = 0;       // Nanoseconds per MIDI tick
-static uint64_t nanosPerBeat = 0;       // Nanoseconds per beat (for timer scheduling)
+static uint64_t loopStartTime = 0;      // When current loop started (scheduled downbeat)
+static uint32_t loopStartFrac = 0;      // Fractional mach tick of loopStartTime (phase accumulator)
+static uint64_t nextLoopStartTime = 0;  // Next downbeat, precomputed by schedule_next_beat
+static uint32_t nextLoopStartFrac = 0;
+static uint64_t loopCount = 0;          // Completed session loops since clock start
+static uint64_t nextLoopCount = 0;
 static uint64_t nextBeatMachTime = 0;   // Next beat in mach ticks (drift-corrected)
-static uint32_t totalLoopTicks = TICKS_PER_BEAT * TOTAL_BEATS;
+
+// Global state - Session loop length and meter (changed with , . ;)
+static int beatsPerBar = DEFAULT_BEATS_PER_BAR;
+static int loopBars = DEFAULT_LOOP_BARS;
+static int totalBeats = DEFAULT_BEATS_PER_BAR * DEFAULT_LOOP_BARS;
+static uint32_t totalLoopTicks = TICKS_PER_BEAT * DEFAULT_BEATS_PER_BAR * DEFAULT_LOOP_BARS;
+
+// Global state - Tempo map (rebuilt by tempo_map_build, read by the timing hot path)
+static TempoSegment tempoSegments[MAX_TEMPO_SEGMENTS];
+static int tempoSegmentCount = 0;
+static TempoNode tempoNodes[MAX_TEMPO_NODES];
+static int tempoNodeCount = 0;
+static uint64_t loopMach = 0;           // Total loop duration in mach ticks (integer part)
+static uint32_t loopMachFrac = 0;       // Fractional part (0.32) so successive loops never drift
+static int tempoMaxBPM = 120;           // Fastest tempo in the map (for playback timer rate)
 
 // Global state - Timers
 static CFRunLoopTimerRef beatTimer = NULL;
@@ -212,20 +936,47 @@ static CFRunLoopTimerRef programChangeTimer = NULL;
 static int programChangeDirection = 0;
 static CFRunLoopTimerRef tempoChangeTimer = NULL;
 static int tempoChangeDirection = 0;
+static bool tempoChangeRamp = false;    // Auto-repeat adjusts loop-end tempo instead
 
 // Global state - Playback tracking
-static uint32_t lastPlaybackTick = 0;
-static bool playbackWrapped = false;  // Track loop wrap for playback
+static uint64_t lastSongTick = 0;     // Absolute song position at the last playback tick
+static uint64_t playingNotes[MIDI_TRACKS][2];  // Notes sounding from playback (released on locate)
+static uint64_t recordedNotes[MIDI_TRACKS][2];  // Pitches recorded since the last rebuild (sounded live)
+
+// Global state - Record mode. Replace and punch takes erase the notes the
+// playhead passes over: the covered interval is muted as it grows and erased
+// as sorted range removals when the pass ends (or early, if the track fills).
+typedef enum { RECORD_OVERDUB, RECORD_REPLACE, RECORD_PUNCH } RecordMode;
+static const char *recordModeNames[RECORD_MODE_COUNT] = { "OVR", "RPL", "PCH" };
+static RecordMode recordMode = RECORD_OVERDUB;
+static int takeChannel = -1;          // Track being replaced (-1 = no replace take)
+static int takeBase = 0;              // Notes below this index predate the current pass (sorted)
+static uint32_t takeStartTick = 0;    // Track tick where the current pass began
+static uint32_t takeCovered = 0;      // Ticks the playhead has passed in this pass
+
+// Global state - Locate and loop region (bars are 0-based)
+static int locateBar = 0;             // Bar the clock starts from
+static int regionStartBar = 0;        // Loop region A (inclusive)
+static int regionEndBar = 0;          // Loop region B (exclusive)
+static bool regionEnabled = false;
 
 // Forward declarations
 static void beat_tick(CFRunLoopTimerRef timer, void *info);
 static void playback_tick(CFRunLoopTimerRef timer, void *info);
 static void update_status_display(void);
 static void schedule_next_beat(void);
+static void relocate_transport(uint32_t tick, uint64_t anchor, bool newPass);
+static bool region_active(void);
 static void start_playback_timer(void);
 static void stop_playback_timer(void);
 static void start_recording_on_beat(void);
 static void stop_recording(void);
+static void release_track_notes(int t);
+static void chase_track(int t, uint32_t pos);
+static void rechase_track(int t);
+static inline bool take_mutes(int t, uint32_t tick);
+static void take_trim_takes(MIDITrack *track);
+static void send_track_mix(int t);
 static void select_midi_output(int index);
 
 // Terminal handling
@@ -251,325 +1002,2748 @@ static uint64_t mach_to_nanos(uint64_t mach_ticks) {
     return mach_ticks * timebaseInfo.numer / timebaseInfo.denom;
 }
 
-static uint64_t nanos_to_mach(uint64_t nanos) {
-    return nanos * timebaseInfo.denom / timebaseInfo.numer;
+// Tempo map - expand segments into a cumulative table of constant-tempo nodes.
+// Ramps are approximated by steps every TEMPO_RAMP_STEP ticks (tempo taken at each
+// step's midpoint), so all floating point work happens here and never per lookup.
+// Node start times are rounded from an exact running total, so error never
+// accumulates from node to node or loop to loop.
+static void tempo_map_build(void) {
+    long double machPerNano = (long double)timebaseInfo.denom / timebaseInfo.numer;
+    long double machTotal = 0;
+    double maxBPM = 0;
+    tempoNodeCount = 0;
+
+    for (int s = 0; s < tempoSegmentCount; s++) {
+        TempoSegment *seg = &tempoSegments[s];
+        uint32_t segEnd = (s + 1 < tempoSegmentCount) ? tempoSegments[s + 1].tick : totalLoopTicks;
+        if (segEnd > totalLoopTicks) segEnd = totalLoopTicks;
+        if (seg->tick >= segEnd) continue;
+
+        uint32_t span = segEnd - seg->tick;
+        bool ramp = (seg->startBPM != seg->endBPM);
+        uint32_t step = ramp ? TEMPO_RAMP_STEP : span;
+
+        for (uint32_t t = seg->tick; t < segEnd && tempoNodeCount < MAX_TEMPO_NODES; t += step) {
+            uint32_t len = (segEnd - t < step) ? segEnd - t : step;
+            double mid = (t - seg->tick) + len * 0.5;
+            double bpm = seg->startBPM + (seg->endBPM - seg->startBPM) * mid / span;
+            long double machPerTick = 60.0e9L / (bpm * TICKS_PER_BEAT) * machPerNano;
+
+            TempoNode *node = &tempoNodes[tempoNodeCount++];
+            node->tick = t;
+            node->microsPerBeat = (uint32_t)(60.0e6 / bpm + 0.5);
+            node->mach = (uint64_t)(machTotal + 0.5L);
+            node->machPerTick = (uint64_t)(machPerTick * 4294967296.0L + 0.5L);
+            node->ticksPerMach = (uint64_t)ceill(79228162514264337593543950336.0L / node->machPerTick);
+            machTotal += len * machPerTick;
+            if (bpm > maxBPM) maxBPM = bpm;
+        }
+    }
+    loopMach = (uint64_t)machTotal;
+    loopMachFrac = (uint32_t)((machTotal - loopMach) * 4294967296.0L);
+    tempoMaxBPM = (int)(maxBPM + 0.5);
+}
+
+// Set the map to a single segment: constant tempo, or a linear ramp across the whole loop
+static void tempo_map_set_ramp(int startBPM, int endBPM) {
+    tempoSegments[0].tick = 0;
+    tempoSegments[0].startBPM = startBPM;
+    tempoSegments[0].endBPM = endBPM;
+    tempoSegmentCount = 1;
+    tempo_map_build();
+}
+
+// Binary search for the last node starting at or before tick - O(log nodes)
+static const TempoNode *tempo_node_for_tick(uint32_t tick) {
+    int lo = 0, hi = tempoNodeCount - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) >> 1;
+        if (tempoNodes[mid].tick <= tick) lo = mid;
+        else hi = mid - 1;
+    }
+    return &tempoNodes[lo];
+}
+
+static const TempoNode *tempo_node_for_mach(uint64_t mach) {
+    int lo = 0, hi = tempoNodeCount - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) >> 1;
+        if (tempoNodes[mid].mach <= mach) lo = mid;
+        else hi = mid - 1;
+    }
+    return &tempoNodes[lo];
+}
+
+// Mach offset within a node at which the node's delta'th tick is first reached
+static inline uint64_t tempo_node_mach(const TempoNode *node, uint32_t delta) {
+    return (uint64_t)(((unsigned __int128)delta * node->machPerTick + 0xFFFFFFFFu) >> 32);
+}
+
+// First mach offset (from loop start) at which tick has been reached
+static uint64_t tempo_tick_to_mach(uint32_t tick) {
+    if (tick >= totalLoopTicks) return loopMach;
+    const TempoNode *node = tempo_node_for_tick(tick);
+    return node->mach + tempo_node_mach(node, tick - node->tick);
+}
+
+// Exact inverse of tempo_tick_to_mach: the rounded-up reciprocal is never more than
+// one tick high, so a single multiply-back check replaces the division
+static uint32_t tempo_mach_to_tick(uint64_t mach) {
+    const TempoNode *node = tempo_node_for_mach(mach);
+    uint64_t offset = mach - node->mach;
+    uint32_t delta = (uint32_t)(((unsigned __int128)offset * node->ticksPerMach) >> 64);
+    if (tempo_node_mach(node, delta) > offset) delta--;
+    return node->tick + delta;
 }
 
 static void update_timing_constants(void) {
-    // Calculate nanoseconds per MIDI tick based on BPM
-    // 1 beat = TICKS_PER_BEAT ticks
-    // 1 minute = metronomeBPM beats
-    // So: nanos per tick = (60 * 1e9) / (BPM * TICKS_PER_BEAT)
-    nanosPerTick = (uint64_t)(60.0 * 1e9 / (metronomeBPM * TICKS_PER_BEAT));
-    nanosPerBeat = (uint64_t)(60.0 * 1e9 / metronomeBPM);
+    tempo_map_set_ramp(metronomeBPM, tempoEndBPM);
+    // Send delay: a dotted eighth at the current tempo
+    atomic_store_explicit(&fxDelayFrames, (uint32_t)(0.75 * 60.0 / metronomeBPM * SYNTH_SAMPLE_RATE),
+                          memory_order_relaxed);
+}
+
+// Division-free: elapsed mach time is looked up directly in the tempo table.
+// Returns the tick within the session loop and the number of completed loops.
+static uint32_t get_loop_position(uint64_t *loops) {
+    uint64_t elapsed = mach_absolute_time() - loopStartTime;
+    *loops = loopCount;
+    if (elapsed >= loopMach) {
+        // Beat timer late at loop end - playhead is already into the next loop
+        elapsed -= loopMach;
+        (*loops)++;
+        if (elapsed >= loopMach) {
+            *loops += elapsed / loopMach;
+            elapsed %= loopMach;
+        }
+    }
+    return tempo_mach_to_tick(elapsed);
 }
 
 static uint32_t get_current_tick(void) {
     if (!clockRunning) return 0;
-    uint64_t now = mach_absolute_time();
-    uint64_t elapsedNanos = mach_to_nanos(now - loopStartTime);
-    uint32_t tick = (uint32_t)(elapsedNanos / nanosPerTick);
-    return tick % totalLoopTicks;
+    uint64_t loops;
+    return get_loop_position(&loops);
 }
 
-// Audio initialization
-static bool init_audio(void) {
-    OSStatus err;
-    err = NewAUGraph(&graph);
-    if (err) return false;
+// Absolute position since clock start - drives the independent per-track loops
+static uint64_t get_song_tick(void) {
+    if (!clockRunning) return 0;
+    uint64_t loops;
+    uint32_t tick = get_loop_position(&loops);
+    return loops * totalLoopTicks + tick;
+}
 
-    AudioComponentDescription cd = {0};
-    cd.componentType = kAudioUnitType_MusicDevice;
-    cd.componentSubType = kAudioUnitSubType_DLSSynth;
-    cd.componentManufacturer = kAudioUnitManufacturer_Apple;
+// Host time a song tick falls on (inverse of get_song_tick)
+static uint64_t song_tick_to_mach(uint64_t songTick) {
+    uint64_t loops = songTick / totalLoopTicks;
+    uint64_t mach = loopStartTime + tempo_tick_to_mach((uint32_t)(songTick % totalLoopTicks));
+    if (loops >= loopCount) return mach + (loops - loopCount) * loopMach;
+    return mach - (loopCount - loops) * loopMach;
+}
 
-    err = AUGraphAddNode(graph, &cd, &synthNode);
-    if (err) return false;
+// Downbeat one loop after start: loopMach plus a 0.32 phase accumulator in
+// *frac, so successive loops never drift however long the session runs
+static uint64_t loop_start_after(uint64_t start, uint32_t *frac) {
+    uint64_t sum = (uint64_t)*frac + loopMachFrac;
+    *frac = (uint32_t)sum;
+    return start + loopMach + (sum >> 32);
+}
 
-    AUNode outputNode;
-    cd.componentType = kAudioUnitType_Output;
-    cd.componentSubType = kAudioUnitSubType_DefaultOutput;
+static uint32_t track_loop_ticks(const MIDITrack *track) {
+    if (track->loopBars == 0) return totalLoopTicks;
+    return (uint32_t)(track->loopBars * beatsPerBar * TICKS_PER_BEAT);
+}
 
-    err = AUGraphAddNode(graph, &cd, &outputNode);
-    if (err) return false;
+static int track_loop_beats(const MIDITrack *track) {
+    return (int)(track_loop_ticks(track) / TICKS_PER_BEAT);
+}
 
-    err = AUGraphConnectNodeInput(graph, synthNode, 0, outputNode, 0);
-    if (err) return false;
+// Current position within a track's own loop (for recording)
+static uint32_t get_track_tick(const MIDITrack *track) {
+    uint32_t len = track_loop_ticks(track);
+    if (len == totalLoopTicks) return get_current_tick();
+    return (uint32_t)(get_song_tick() % len);
+}
 
-    err = AUGraphOpen(graph);
-    if (err) return false;
+// Event ordering - stable LSD radix sort by tick, with note-offs before note-ons
+// on the same tick so a re-triggered note is never cut by its own note-off.
+// Linear time; 8-bit digits, skipping digits that are identical for every key.
+static MIDIEvent sortScratch[MAX_EVENTS_PER_TRACK];
 
-    err = AUGraphNodeInfo(graph, synthNode, NULL, &synthUnit);
-    if (err) return false;
+static inline uint32_t event_sort_key(const MIDIEvent *ev) {
+    return (ev->tick << 1) | (ev->status == 0x90);
+}
 
-    err = AUGraphInitialize(graph);
-    if (err) return false;
+static void sort_events(MIDIEvent *events, int count) {
+    if (count < 2 || count > MAX_EVENTS_PER_TRACK) return;
 
-    err = AUGraphStart(graph);
-    if (err) return false;
+    uint32_t keyOr = 0, keyAnd = UINT32_MAX;
+    for (int i = 0; i < count; i++) {
+        uint32_t key = event_sort_key(&events[i]);
+        keyOr |= key;
+        keyAnd &= key;
+    }
 
-    return true;
+    MIDIEvent *src = events, *dst = sortScratch;
+    for (int shift = 0; shift < 32 && (keyOr >> shift); shift += 8) {
+        if (((keyOr ^ keyAnd) >> shift & 0xFF) == 0) continue;  // Digit constant - already ordered
+
+        int offsets[256] = {0};
+        for (int i = 0; i < count; i++) offsets[event_sort_key(&src[i]) >> shift & 0xFF]++;
+        for (int d = 0, sum = 0; d < 256; d++) {
+            int c = offsets[d];
+            offsets[d] = sum;
+            sum += c;
+        }
+        for (int i = 0; i < count; i++) dst[offsets[event_sort_key(&src[i]) >> shift & 0xFF]++] = src[i];
+
+        MIDIEvent *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != events) memcpy(events, src, count * sizeof(MIDIEvent));
 }
 
-// MIDI Output initialization
-static bool init_midi_output(void) {
-    OSStatus status = MIDIClientCreate(CFSTR("terminalMIDI"), NULL, NULL, &midiClient);
-    if (status != noErr) return false;
+// Note ordering - stable LSD radix sort of note records by start tick
+static MIDINote noteScratch[MAX_NOTES_PER_TRACK];
 
-    status = MIDIOutputPortCreate(midiClient, CFSTR("Output"), &midiOutPort);
-    if (status != noErr) return false;
+static void sort_notes(MIDINote *notes, int count) {
+    if (count < 2 || count > MAX_NOTES_PER_TRACK) return;
 
-    // Enumerate MIDI destinations
-    ItemCount destCount = MIDIGetNumberOfDestinations();
-    midiDestCount = 0;
+    uint32_t keyOr = 0;
+    for (int i = 0; i < count; i++) keyOr |= notes[i].start;
 
-    for (ItemCount i = 0; i < destCount && midiDestCount < MAX_MIDI_DESTINATIONS; i++) {
-        MIDIEndpointRef dest = MIDIGetDestination(i);
-        if (dest) {
-            midiDestinations[midiDestCount] = dest;
+    MIDINote *src = notes, *dst = noteScratch;
+    for (int shift = 0; shift < 32 && (keyOr >> shift); shift += 8) {
+        int offsets[256] = {0};
+        for (int i = 0; i < count; i++) offsets[src[i].start >> shift & 0xFF]++;
+        for (int d = 0, sum = 0; d < 256; d++) {
+            int c = offsets[d];
+            offsets[d] = sum;
+            sum += c;
+        }
+        for (int i = 0; i < count; i++) dst[offsets[src[i].start >> shift & 0xFF]++] = src[i];
 
-            // Get destination name
-            CFStringRef name = NULL;
-            MIDIObjectGetStringProperty(dest, kMIDIPropertyName, &name);
-            if (name) {
-                CFStringGetCString(name, midiDestNames[midiDestCount], 64, kCFStringEncodingUTF8);
-                CFRelease(name);
+        MIDINote *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != notes) memcpy(notes, src, count * sizeof(MIDINote));
+}
+
+// First note in notes[0, count) starting at or after tick (must be sorted)
+static int find_note_index(const MIDINote *notes, int count, uint32_t tick) {
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = (lo + hi) >> 1;
+        if (notes[mid].start < tick) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Binary search for the first event at or after tick (events must be sorted)
+static int find_event_index(const MIDITrack *track, uint32_t tick) {
+    int lo = 0, hi = track->eventCount;
+    while (lo < hi) {
+        int mid = (lo + hi) >> 1;
+        if (track->events[mid].tick < tick) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Bulk transform kernels - quantize, transpose and velocity-scale whole arrays.
+// Written with compiler vector extensions (NEON on Apple silicon, SSE2 on
+// Intel); the scalar versions handle the tail and define the exact results.
+// Quantize uses a float reciprocal with an integer remainder fix-up instead of
+// a divide per note; all intermediate values are small integers, so it is exact.
+typedef struct {
+    int32_t grid;           // Grid in ticks (0 = off)
+    int32_t half;           // grid / 2 - round to nearest, ties up
+    float reciprocal;       // 1 / grid
+    int32_t swing;          // Ticks added to every second grid line
+    int32_t strength;       // Q8 - 256 moves a note all the way to the grid
+    int32_t len;            // Loop length - results wrap into [0, len)
+} QuantizeParams;
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TRANSFORM_SIMD 1
+typedef int32_t vec_i32 __attribute__((vector_size(16)));
+typedef float vec_f32 __attribute__((vector_size(16)));
+typedef uint8_t vec_u8 __attribute__((vector_size(16)));
+typedef int16_t vec_i16x16 __attribute__((vector_size(32)));
+#endif
+
+static QuantizeParams quantize_params(const MIDITrack *track, uint32_t len) {
+    QuantizeParams q;
+    q.grid = (int32_t)quantizeGridTicks[track->quantizeGrid];
+    q.half = q.grid / 2;
+    q.reciprocal = q.grid ? 1.0f / (float)q.grid : 0.0f;
+    q.swing = q.grid * 2 * (quantizeSwingPercent[track->quantizeSwing] - 50) / 100;
+    q.strength = quantizeStrengthPercent[track->quantizeStrength] * 256 / 100;
+    q.len = (int32_t)len;
+    return q;
+}
+
+static inline uint32_t quantize_tick_scalar(uint32_t tick, const QuantizeParams *q) {
+    int32_t t = (int32_t)tick;
+    int32_t step = (t + q->half) / q->grid;
+    int32_t target = step * q->grid + ((step & 1) ? q->swing : 0);
+    int32_t moved = t + (((target - t) * q->strength) >> 8);
+    if (moved < 0) moved += q->len;
+    if (moved >= q->len) moved -= q->len;
+    return (uint32_t)moved;
+}
+
+static void quantize_ticks(uint32_t *ticks, int count, const QuantizeParams *q) {
+    if (q->grid == 0) return;
+    int i = 0;
+#ifdef TRANSFORM_SIMD
+    const vec_i32 grid = {q->grid, q->grid, q->grid, q->grid};
+    const vec_i32 half = {q->half, q->half, q->half, q->half};
+    const vec_i32 swing = {q->swing, q->swing, q->swing, q->swing};
+    const vec_i32 strength = {q->strength, q->strength, q->strength, q->strength};
+    const vec_i32 len = {q->len, q->len, q->len, q->len};
+    const vec_f32 reciprocal = {q->reciprocal, q->reciprocal, q->reciprocal, q->reciprocal};
+    for (; i + 4 <= count; i += 4) {
+        vec_i32 t;
+        memcpy(&t, &ticks[i], sizeof(t));
+        vec_i32 n = t + half;
+        vec_i32 step = __builtin_convertvector(__builtin_convertvector(n, vec_f32) * reciprocal, vec_i32);
+        vec_i32 rem = n - step * grid;
+        step -= (rem >= grid);          // Comparisons are 0 / -1 per lane
+        step += (rem < 0);
+        vec_i32 target = step * grid + (-(step & 1) & swing);
+        vec_i32 moved = t + (((target - t) * strength) >> 8);
+        moved += (moved < 0) & len;
+        moved -= (moved >= len) & len;
+        memcpy(&ticks[i], &moved, sizeof(moved));
+    }
+#endif
+    for (; i < count; i++) ticks[i] = quantize_tick_scalar(ticks[i], q);
+}
+
+// Transpose pitches by semitones, clamped to 0-127
+static void transpose_notes(uint8_t *notes, int count, int semitones) {
+    if (semitones == 0) return;
+    int i = 0;
+#ifdef TRANSFORM_SIMD
+    const vec_i16x16 shift = (vec_i16x16){0} + (int16_t)semitones;
+    const vec_i16x16 hi = (vec_i16x16){0} + 127;
+    for (; i + 16 <= count; i += 16) {
+        vec_u8 v;
+        memcpy(&v, &notes[i], sizeof(v));
+        vec_i16x16 w = __builtin_convertvector(v, vec_i16x16) + shift;
+        w &= ~(w < 0);                        // Clamp low (masks are 0 / -1 per lane)
+        vec_i16x16 over = (w > hi);
+        w = (w & ~over) | (hi & over);        // Clamp high
+        v = __builtin_convertvector(w, vec_u8);
+        memcpy(&notes[i], &v, sizeof(v));
+    }
+#endif
+    for (; i < count; i++) {
+        int n = notes[i] + semitones;
+        notes[i] = (uint8_t)(n < 0 ? 0 : (n > 127 ? 127 : n));
+    }
+}
+
+// Scale velocities by a Q7 factor (128 = unity, at most 256), clamped to 1-127
+static void scale_velocities(uint8_t *velocities, int count, int scale) {
+    if (scale == 128) return;
+    int i = 0;
+#ifdef TRANSFORM_SIMD
+    const vec_i16x16 factor = (vec_i16x16){0} + (int16_t)scale;
+    const vec_i16x16 lo = (vec_i16x16){0} + 1, hi = (vec_i16x16){0} + 127;
+    for (; i + 16 <= count; i += 16) {
+        vec_u8 v;
+        memcpy(&v, &velocities[i], sizeof(v));
+        vec_i16x16 w = (__builtin_convertvector(v, vec_i16x16) * factor) >> 7;  // 127 * 256 fits
+        vec_i16x16 under = (w < lo), over = (w > hi);
+        w = (w & ~under) | (lo & under);
+        w = (w & ~over) | (hi & over);
+        v = __builtin_convertvector(w, vec_u8);
+        memcpy(&velocities[i], &v, sizeof(v));
+    }
+#endif
+    for (; i < count; i++) {
+        int v = (velocities[i] * scale) >> 7;
+        velocities[i] = (uint8_t)(v < 1 ? 1 : (v > 127 ? 127 : v));
+    }
+}
+
+// Groove - extract the average timing offset and velocity of each 16th slot in
+// a bar from a track's raw notes; one linear pass, no allocation.
+static void groove_extract(const MIDITrack *track, Groove *out) {
+    int32_t offsetSum[GROOVE_MAX_SLOTS] = {0};
+    uint32_t velocitySum[GROOVE_MAX_SLOTS] = {0};
+    uint16_t hits[GROOVE_MAX_SLOTS] = {0};
+    int slots = beatsPerBar * 4;
+    uint32_t len = track_loop_ticks(track);
+
+    for (int i = 0; i < track->noteCount; i++) {
+        const MIDINote *n = &track->notes[i];
+        if (n->length == 0 || n->start >= len) continue;
+        uint32_t step = (n->start + TICKS_PER_16TH / 2) / TICKS_PER_16TH;
+        int slot = (int)(step % slots);
+        offsetSum[slot] += (int32_t)n->start - (int32_t)(step * TICKS_PER_16TH);
+        velocitySum[slot] += n->velocity;
+        hits[slot]++;
+    }
+
+    for (int s = 0; s < slots; s++) {
+        out->offset[s] = hits[s] ? (int16_t)(offsetSum[s] / hits[s]) : 0;
+        out->velocity[s] = hits[s] ? (uint8_t)(velocitySum[s] / hits[s]) : 0;
+    }
+    out->slots = slots;
+}
+
+// Groove - move note starts (and velocities) toward the groove in one pass.
+// Strength is Q8 as in QuantizeParams; a track's own meter may differ from the
+// groove's, so slots wrap at the groove's length.
+static void groove_apply(const Groove *g, uint32_t *starts, uint8_t *velocities, int count,
+                         int32_t strength, uint32_t len) {
+    if (g->slots == 0) return;
+    for (int i = 0; i < count; i++) {
+        int32_t t = (int32_t)starts[i];
+        uint32_t step = (starts[i] + TICKS_PER_16TH / 2) / TICKS_PER_16TH;
+        int slot = (int)(step % g->slots);
+        int32_t target = (int32_t)(step * TICKS_PER_16TH) + g->offset[slot];
+        int32_t moved = t + (((target - t) * strength) >> 8);
+        if (moved < 0) moved += (int32_t)len;
+        if (moved >= (int32_t)len) moved -= (int32_t)len;
+        starts[i] = (uint32_t)moved;
+
+        if (g->velocity[slot]) {
+            int32_t v = velocities[i];
+            v += ((g->velocity[slot] - v) * strength) >> 8;
+            velocities[i] = (uint8_t)(v < 1 ? 1 : v);
+        }
+    }
+}
+
+// Build the wire events for a track from its notes. Note-offs are placed at
+// start + length wrapped into the track's current loop, so every note ends
+// even after the loop is shortened; notes past a shortened loop are skipped.
+// Quantize, transpose and velocity scale are applied here in bulk, so the
+// recorded performance is never overwritten.
+static uint32_t buildStarts[MAX_NOTES_PER_TRACK];
+static uint32_t buildLengths[MAX_NOTES_PER_TRACK];
+static uint8_t buildPitches[MAX_NOTES_PER_TRACK];
+static uint8_t buildVelocities[MAX_NOTES_PER_TRACK];
+
+// Notes a track plays from: its own and every take's. Recording and capture
+// keep this within MAX_NOTES_PER_TRACK (sealing a pass into a take does not
+// change it), so the build arrays and events[] always hold a whole comp.
+static int track_note_total(const MIDITrack *track) {
+    int total = track->noteCount;
+    for (int k = 0; k < track->takeCount; k++) total += (int)track->takes[k].count;
+    return total;
+}
+
+// Append playable notes to the build arrays. With a comp mask, a note is taken
+// only if bit is set for the bar it starts in (the per-bar take indirection).
+// Notes of track 'replaced' that a replace / punch take has covered are left out.
+static int gather_notes(const MIDINote *notes, int n, uint32_t len, int count,
+                        const uint16_t *compMask, uint16_t bit, int replaced) {
+    uint32_t barTicks = (uint32_t)beatsPerBar * TICKS_PER_BEAT;
+    for (int i = 0; i < n && count < MAX_NOTES_PER_TRACK; i++) {
+        const MIDINote *note = &notes[i];
+        if (note->length == 0 || note->start >= len) continue;
+        if (compMask && !(compMask[note->start / barTicks] & bit)) continue;
+        if (take_mutes(replaced, note->start)) continue;
+        buildStarts[count] = note->start;
+        buildLengths[count] = note->length < len ? note->length : len;
+        buildPitches[count] = note->note;
+        buildVelocities[count] = note->velocity;
+        count++;
+    }
+    return count;
+}
+
+// Chase snapshots: what sounds at each bar line (after the events before it),
+// from two sweeps of the sorted events - the first finds the notes held across
+// the loop end into bar 0. A chase then starts from its bar's snapshot.
+static void track_build_chase(MIDITrack *track, uint32_t len) {
+    uint32_t barTicks = (uint32_t)beatsPerBar * TICKS_PER_BEAT;
+    uint64_t sounding[2] = { 0, 0 };
+    uint8_t velocity[128] = { 0 };
+    for (int pass = 0, b = 0; pass < 2; pass++) {
+        for (int i = 0; i <= track->eventCount; i++) {
+            uint32_t tick = i < track->eventCount ? track->events[i].tick : len;
+            for (; pass == 1 && b < MAX_LOOP_BARS && (uint32_t)b * barTicks <= tick && (uint32_t)b * barTicks < len; b++) {
+                track->barSounding[b][0] = sounding[0];
+                track->barSounding[b][1] = sounding[1];
+                memcpy(track->barVelocity[b], velocity, sizeof(velocity));
+                track->barIndex[b] = i;
+            }
+            if (i == track->eventCount) break;
+            const MIDIEvent *ev = &track->events[i];
+            uint64_t bit = 1ull << (ev->note & 63);
+            if (ev->status == 0x90) {
+                sounding[ev->note >> 6] |= bit;
+                velocity[ev->note] = ev->velocity;
             } else {
-                snprintf(midiDestNames[midiDestCount], 64, "MIDI Output %d", midiDestCount + 1);
+                sounding[ev->note >> 6] &= ~bit;
             }
-            midiDestCount++;
         }
     }
-
-    return true;
 }
 
-// Select MIDI output destination (0 = internal synth, 1-9 = external)
-static void select_midi_output(int index) {
-    if (index == 0) {
-        selectedOutput = 0;  // Internal synth
-    } else if (index > 0 && index <= midiDestCount) {
-        selectedOutput = index;  // External MIDI destination
+static void track_build_events(MIDITrack *track) {
+    uint32_t len = track_loop_ticks(track);
+
+    // Gather playable notes into flat arrays for the transform kernels: the
+    // track's own notes (those predating a replace pass in progress first),
+    // then each take's notes read in place from the arena (takes predate it)
+    int t = (int)(track - tracks);
+    int old = t == takeChannel ? takeBase : track->noteCount;
+    int count = gather_notes(track->notes, old, len, 0, NULL, 0, t);
+    count = gather_notes(&track->notes[old], track->noteCount - old, len, count, NULL, 0, -1);
+    for (int k = 0; k < track->takeCount; k++) {
+        const Take *take = &track->takes[k];
+        count = gather_notes(&takeArena[take->first], (int)take->count, len, count,
+                             track->compMask, (uint16_t)(1u << k), t);
+    }
+
+    QuantizeParams q = quantize_params(track, len);
+    if (track->quantizeGrid == QUANTIZE_GRID_GROOVE) {
+        groove_apply(&groove, buildStarts, buildVelocities, count, q.strength, len);
     } else {
-        return;  // Invalid selection, ignore
+        quantize_ticks(buildStarts, count, &q);
     }
-    update_status_display();
+    transpose_notes(buildPitches, count, track->transpose);
+    scale_velocities(buildVelocities, count, 128 + 16 * track->velocityTrim);
+
+    for (int i = 0; i < count; i++) {
+        uint32_t end = buildStarts[i] + buildLengths[i];
+        if (end >= len) end -= len;
+
+        MIDIEvent *ev = &track->events[2 * i];
+        ev->tick = buildStarts[i];
+        ev->status = 0x90;
+        ev->note = buildPitches[i];
+        ev->velocity = buildVelocities[i];
+
+        ev = &track->events[2 * i + 1];
+        ev->tick = end;
+        ev->status = 0x80;
+        ev->note = buildPitches[i];
+        ev->velocity = 0;
+    }
+    track->eventCount = 2 * count;
+    sort_events(track->events, track->eventCount);
+    track_build_chase(track, len);
 }
 
-// Send MIDI to external destination
-static void send_midi_to_output(uint8_t status, uint8_t data1, uint8_t data2) {
-    if (selectedOutput == 0 || selectedOutput > midiDestCount) return;
+// Rebuild a track's events if needed and re-seek its cursor to playPos. While
+// the clock runs, the notes playback started belong to the old events, so the
+// track is re-chased against the new ones (only notes the edit changed move).
+static void track_prepare(MIDITrack *track) {
+    if (!track->dirty) return;
+    if (clockRunning) {
+        rechase_track((int)(track - tracks));
+        return;
+    }
+    track_build_events(track);
+    track->dirty = false;
+    track->playIndex = find_event_index(track, track->playPos);
+}
 
-    MIDIEndpointRef dest = midiDestinations[selectedOutput - 1];
-    Byte buffer[64];
-    MIDIPacketList *packetList = (MIDIPacketList *)buffer;
-    MIDIPacket *packet = MIDIPacketListInit(packetList);
+// Re-sync every track cursor to the song position (tempo, loop or meter
+// change). Only the cursors move; dirty tracks are re-seeked when rebuilt.
+static void sync_track_cursors(uint64_t songTick) {
+    for (int t = 0; t < MIDI_TRACKS; t++) {
+        MIDITrack *track = &tracks[t];
+        track->playPos = (uint32_t)(songTick % track_loop_ticks(track));
+        if (!track->dirty) track->playIndex = find_event_index(track, track->playPos);
+    }
+    lastSongTick = songTick;
+}
 
-    Byte midiData[3] = {status, data1, data2};
-    packet = MIDIPacketListAdd(packetList, sizeof(buffer), packet, 0, 3, midiData);
+// Audio initialization
+// Native synth - voice lists. All O(1); called only from the render thread.
+static void voice_unlink(int v) {
+    SynthVoice *voice = &synthVoices[v];
+    if (voice->prev >= 0) synthVoices[voice->prev].next = voice->next;
+    else voiceListHead[voice->list] = voice->next;
+    if (voice->next >= 0) synthVoices[voice->next].prev = voice->prev;
+    else voiceListTail[voice->list] = voice->prev;
+}
 
-    if (packet) {
-        MIDISend(midiOutPort, dest, packetList);
+static void voice_link_tail(int v, uint8_t list) {
+    SynthVoice *voice = &synthVoices[v];
+    voice->list = list;
+    voice->prev = voiceListTail[list];
+    voice->next = -1;
+    if (voice->prev >= 0) synthVoices[voice->prev].next = (int8_t)v;
+    else voiceListHead[list] = (int8_t)v;
+    voiceListTail[list] = (int8_t)v;
+}
+
+static void voice_free(int v) {
+    voice_unlink(v);
+    SynthVoice *voice = &synthVoices[v];
+    if (voiceMap[voice->channel][voice->note] == v) voiceMap[voice->channel][voice->note] = -1;
+    voiceFreeMask |= 1ull << v;
+}
+
+// A free voice (lowest set bit), or the oldest released voice, or the oldest held one
+static int voice_alloc(void) {
+    if (voiceFreeMask) {
+        int v = __builtin_ctzll(voiceFreeMask);
+        voiceFreeMask &= voiceFreeMask - 1;
+        return v;
     }
+    int v = voiceListHead[VOICE_RELEASED] >= 0 ? voiceListHead[VOICE_RELEASED] : voiceListHead[VOICE_HELD];
+    voice_free(v);
+    voiceFreeMask &= ~(1ull << v);
+    return v;
 }
 
-// MIDI functions - route to internal synth OR external MIDI based on selection
-static void note_on_internal(int channel, uint8_t note, uint8_t velocity) {
-    if (note >= 128) return;
+// SoundFont loading - RIFF walk over the mapping. All fields little-endian.
+static inline uint16_t le16(const uint8_t *p) { return (uint16_t)(p[0] | p[1] << 8); }
+static inline uint32_t le32(const uint8_t *p) { return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24; }
+
+// Find chunk id (or LIST of type id) among the chunks in [p, end)
+static const uint8_t *riff_find(const uint8_t *p, const uint8_t *end, const char *id, uint32_t *size) {
+    while (p + 8 <= end) {
+        uint32_t len = le32(p + 4);
+        if (len > (size_t)(end - p) - 8) return NULL;
+        if (memcmp(p, "LIST", 4) == 0 && len >= 4 && memcmp(p + 8, id, 4) == 0) {
+            *size = len - 4;
+            return p + 12;
+        }
+        if (memcmp(p, id, 4) == 0) {
+            *size = len;
+            return p + 8;
+        }
+        p += 8 + len + (len & 1);
+    }
+    return NULL;
+}
 
-    if (selectedOutput == 0) {
-        // Internal synth
-        if (synthUnit) {
-            MusicDeviceMIDIEvent(synthUnit, 0x90 | channel, note, velocity, 0);
+// Generator values of one zone layer (global zone first, then local zone)
+enum {
+    GEN_START = 0, GEN_END = 1, GEN_LOOP_START = 2, GEN_LOOP_END = 3, GEN_START_COARSE = 4,
+    GEN_END_COARSE = 12, GEN_RELEASE = 38, GEN_INSTRUMENT = 41, GEN_KEY_RANGE = 43,
+    GEN_VEL_RANGE = 44, GEN_LOOP_START_COARSE = 45, GEN_ATTENUATION = 48,
+    GEN_LOOP_END_COARSE = 50, GEN_COARSE_TUNE = 51, GEN_FINE_TUNE = 52, GEN_SAMPLE_ID = 53,
+    GEN_SAMPLE_MODES = 54, GEN_ROOT_KEY = 58, GEN_COUNT = 61
+};
+
+typedef struct {
+    int16_t value[GEN_COUNT];
+    bool set[GEN_COUNT];
+} SF2Gens;
+
+// Apply generator records [first, last) of a table holding count records;
+// false for a range that runs backwards or past the table (malformed bank)
+static bool sf2_read_gens(const uint8_t *gen, uint32_t count, uint32_t first, uint32_t last, SF2Gens *g) {
+    if (first > last || last > count) return false;
+    for (uint32_t i = first; i < last; i++) {
+        uint16_t oper = le16(gen + i * 4);
+        if (oper >= GEN_COUNT) continue;
+        g->value[oper] = (int16_t)le16(gen + i * 4 + 2);
+        g->set[oper] = true;
+    }
+    return true;
+}
+
+static inline int sf2_range_lo(const SF2Gens *g, int oper) { return g->set[oper] ? (uint16_t)g->value[oper] & 0xFF : 0; }
+static inline int sf2_range_hi(const SF2Gens *g, int oper) { return g->set[oper] ? (uint16_t)g->value[oper] >> 8 : 127; }
+
+// Resolve one instrument zone (inst: global + local layers) under one preset
+// zone (additive layer) into a flat SF2Zone
+static bool sf2_resolve(const SF2Gens *inst, const SF2Gens *pre, const uint8_t *shdr, uint32_t sampleCount,
+                        SF2Zone *z) {
+    uint32_t id = (uint16_t)inst->value[GEN_SAMPLE_ID];
+    if (id + 1 >= sampleCount) return false;  // Last header is the terminator
+    const uint8_t *h = shdr + id * 46;
+    int32_t start = (int32_t)le32(h + 20) + inst->value[GEN_START] + 32768 * inst->value[GEN_START_COARSE];
+    int32_t end = (int32_t)le32(h + 24) + inst->value[GEN_END] + 32768 * inst->value[GEN_END_COARSE];
+    int32_t loopStart = (int32_t)le32(h + 28) + inst->value[GEN_LOOP_START] + 32768 * inst->value[GEN_LOOP_START_COARSE];
+    int32_t loopEnd = (int32_t)le32(h + 32) + inst->value[GEN_LOOP_END] + 32768 * inst->value[GEN_LOOP_END_COARSE];
+    if (start < 0 || end <= start + 1 || (uint32_t)end > sf2SampleFrames) return false;
+
+    int keyLo = sf2_range_lo(inst, GEN_KEY_RANGE), keyHi = sf2_range_hi(inst, GEN_KEY_RANGE);
+    int velLo = sf2_range_lo(inst, GEN_VEL_RANGE), velHi = sf2_range_hi(inst, GEN_VEL_RANGE);
+    if (sf2_range_lo(pre, GEN_KEY_RANGE) > keyLo) keyLo = sf2_range_lo(pre, GEN_KEY_RANGE);
+    if (sf2_range_hi(pre, GEN_KEY_RANGE) < keyHi) keyHi = sf2_range_hi(pre, GEN_KEY_RANGE);
+    if (sf2_range_lo(pre, GEN_VEL_RANGE) > velLo) velLo = sf2_range_lo(pre, GEN_VEL_RANGE);
+    if (sf2_range_hi(pre, GEN_VEL_RANGE) < velHi) velHi = sf2_range_hi(pre, GEN_VEL_RANGE);
+    if (keyLo > keyHi || velLo > velHi) return false;
+
+    z->start = (uint32_t)start;
+    z->end = (uint32_t)end;
+    z->loopMode = inst->value[GEN_SAMPLE_MODES] & 3;
+    if (loopStart < start || loopEnd > end || loopEnd <= loopStart + 1) z->loopMode = 0;
+    z->loopStart = z->loopMode ? (uint32_t)loopStart : 0;
+    z->loopEnd = z->loopMode ? (uint32_t)loopEnd : 0;
+    z->sampleRate = le32(h + 36);
+    if (z->sampleRate == 0) return false;
+    z->rootKey = inst->set[GEN_ROOT_KEY] && inst->value[GEN_ROOT_KEY] >= 0 ? (uint8_t)inst->value[GEN_ROOT_KEY] : h[40];
+    z->tune = (int16_t)((inst->value[GEN_COARSE_TUNE] + pre->value[GEN_COARSE_TUNE]) * 100 +
+                        inst->value[GEN_FINE_TUNE] + pre->value[GEN_FINE_TUNE] + (int8_t)h[41]);
+    z->attenuation = (int16_t)(inst->value[GEN_ATTENUATION] + pre->value[GEN_ATTENUATION]);
+    int release = (inst->set[GEN_RELEASE] ? inst->value[GEN_RELEASE] : -12000) + pre->value[GEN_RELEASE];
+    z->release = (int16_t)(release < -12000 ? -12000 : release > 8000 ? 8000 : release);  // Unset = instant
+    z->keyLo = (uint8_t)keyLo;
+    z->keyHi = (uint8_t)keyHi;
+    z->velLo = (uint8_t)velLo;
+    z->velHi = (uint8_t)velHi;
+    return true;
+}
+
+static bool sf2_push_zone(const SF2Zone *z, uint32_t *capacity) {
+    if (sf2ZoneCount == *capacity) {
+        uint32_t grown = *capacity ? *capacity * 2 : 256;
+        SF2Zone *zones = realloc(sf2Zones, grown * sizeof(SF2Zone));
+        if (!zones) return false;
+        sf2Zones = zones;
+        *capacity = grown;
+    }
+    sf2Zones[sf2ZoneCount++] = *z;
+    return true;
+}
+
+static void sf2_unload(void) {
+    if (sf2Map) munmap((void *)sf2Map, sf2MapSize);
+    sf2Map = NULL;
+    sf2MapSize = 0;
+    sf2Samples = NULL;
+    sf2SampleFrames = 0;
+    free(sf2Zones);
+    sf2Zones = NULL;
+    sf2ZoneCount = 0;
+    memset(sf2Presets, 0, sizeof(sf2Presets));
+}
+
+// Map the SoundFont at path and index the GM presets (bank 0) and drum kits
+// (bank 128). Work is proportional to the preset tables, not the sample data.
+static bool sf2_load(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 12) { close(fd); return false; }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+    sf2Map = map;
+    sf2MapSize = (size_t)st.st_size;
+
+    const uint8_t *end = sf2Map + sf2MapSize;
+    uint32_t size;
+    bool ok = memcmp(sf2Map, "RIFF", 4) == 0 && memcmp(sf2Map + 8, "sfbk", 4) == 0;
+    const uint8_t *sdta = ok ? riff_find(sf2Map + 12, end, "sdta", &size) : NULL;
+    const uint8_t *smpl = sdta ? riff_find(sdta, sdta + size, "smpl", &size) : NULL;
+    if (smpl) {
+        sf2Samples = (const int16_t *)smpl;
+        sf2SampleFrames = size / 2;
+    }
+    uint32_t pdtaSize = 0;
+    const uint8_t *pdta = ok ? riff_find(sf2Map + 12, end, "pdta", &pdtaSize) : NULL;
+
+    const char *ids[9] = { "phdr", "pbag", "pmod", "pgen", "inst", "ibag", "imod", "igen", "shdr" };
+    const uint32_t recordSize[9] = { 38, 4, 10, 4, 22, 4, 10, 4, 46 };
+    const uint8_t *table[9];
+    uint32_t count[9];
+    for (int i = 0; i < 9 && pdta && smpl; i++) {
+        table[i] = riff_find(pdta, pdta + pdtaSize, ids[i], &size);
+        if (!table[i] || size < 2 * recordSize[i]) { pdta = NULL; break; }
+        count[i] = size / recordSize[i];
+    }
+    if (!pdta || !smpl) {
+        sf2_unload();
+        return false;
+    }
+    const uint8_t *phdr = table[0], *pbag = table[1], *pgen = table[3];
+    const uint8_t *inst = table[4], *ibag = table[5], *igen = table[7], *shdr = table[8];
+
+    uint32_t capacity = 0;
+    for (uint32_t p = 0; p + 1 < count[0]; p++) {
+        const uint8_t *h = phdr + p * 38;
+        uint16_t program = le16(h + 20), bank = le16(h + 22);
+        int kind = bank == 0 ? 0 : bank == SF2_DRUM_BANK ? 1 : -1;
+        if (kind < 0 || program >= 128 || sf2Presets[kind][program].count) continue;
+        SF2Preset *preset = &sf2Presets[kind][program];
+        preset->first = sf2ZoneCount;
+
+        uint16_t bagFirst = le16(h + 24), bagLast = le16(h + 38 + 24);
+        SF2Gens preGlobal = {0};
+        for (uint32_t b = bagFirst; b < bagLast && b + 1 < count[1]; b++) {
+            SF2Gens pre = preGlobal;
+            if (!sf2_read_gens(pgen, count[3], le16(pbag + b * 4), le16(pbag + (b + 1) * 4), &pre)) continue;
+            if (!pre.set[GEN_INSTRUMENT]) {
+                if (b == bagFirst) preGlobal = pre;  // Preset global zone
+                continue;
+            }
+            uint32_t i = (uint16_t)pre.value[GEN_INSTRUMENT];
+            if (i + 1 >= count[4]) continue;
+            uint16_t ibagFirst = le16(inst + i * 22 + 20), ibagLast = le16(inst + (i + 1) * 22 + 20);
+            SF2Gens instGlobal = {0};
+            for (uint32_t ib = ibagFirst; ib < ibagLast && ib + 1 < count[5]; ib++) {
+                SF2Gens g = instGlobal;
+                if (!sf2_read_gens(igen, count[7], le16(ibag + ib * 4), le16(ibag + (ib + 1) * 4), &g)) continue;
+                if (!g.set[GEN_SAMPLE_ID]) {
+                    if (ib == ibagFirst) instGlobal = g;  // Instrument global zone
+                    continue;
+                }
+                SF2Zone z;
+                if (sf2_resolve(&g, &pre, shdr, count[8], &z) && !sf2_push_zone(&z, &capacity)) {
+                    sf2_unload();
+                    return false;
+                }
+            }
         }
-    } else {
-        // External MIDI
-        send_midi_to_output(0x90 | channel, note, velocity);
+        preset->count = sf2ZoneCount - preset->first;
     }
+    if (sf2ZoneCount == 0) {
+        sf2_unload();
+        return false;
+    }
+    return true;
 }
 
-static void note_off_internal(int channel, uint8_t note) {
-    if (note >= 128) return;
+// First zone of the channel's SoundFont preset covering note and velocity
+static const SF2Zone *sf2_find_zone(uint8_t channel, uint8_t note, uint8_t velocity) {
+    if (!sf2Zones) return NULL;
+    int kind = channel == DRUM_CHANNEL;
+    const SF2Preset *preset = &sf2Presets[kind][synthPrograms[channel]];
+    if (preset->count == 0) preset = &sf2Presets[kind][0];
+    for (uint32_t i = 0; i < preset->count; i++) {
+        const SF2Zone *z = &sf2Zones[preset->first + i];
+        if (note >= z->keyLo && note <= z->keyHi && velocity >= z->velLo && velocity <= z->velHi) return z;
+    }
+    return NULL;
+}
 
-    if (selectedOutput == 0) {
-        // Internal synth
-        if (synthUnit) {
-            MusicDeviceMIDIEvent(synthUnit, 0x80 | channel, note, 0, 0);
+// Map <dir>/<note>.wav for every drum note present. The frames are played
+// from the mapping (16-bit PCM, any channel count and rate); returns the
+// number of samples loaded.
+static int drum_samples_load(const char *dir) {
+    int loaded = 0;
+    for (int note = 0; note < 128; note++) {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%d.wav", dir, note);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) continue;
+        struct stat st;
+        void *map = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size >= 12) {
+            map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
         }
-    } else {
-        // External MIDI - use note-on with velocity 0 for better compatibility
-        send_midi_to_output(0x90 | channel, note, 0);
+        close(fd);
+        if (map == MAP_FAILED) continue;
+
+        const uint8_t *base = map, *end = base + st.st_size;
+        uint32_t fmtSize = 0, dataSize = 0;
+        bool wave = memcmp(base, "RIFF", 4) == 0 && memcmp(base + 8, "WAVE", 4) == 0;
+        const uint8_t *fmt = wave ? riff_find(base + 12, end, "fmt ", &fmtSize) : NULL;
+        if (fmtSize < 16) fmt = NULL;
+        const uint8_t *data = fmt ? riff_find(base + 12, end, "data", &dataSize) : NULL;
+        uint16_t format = data ? le16(fmt) : 0;
+        uint16_t channels = data ? le16(fmt + 2) : 0;
+        uint32_t sampleRate = data ? le32(fmt + 4) : 0;
+        if (!data || (format != 1 && format != 0xFFFE) || le16(fmt + 14) != 16 || channels == 0 ||
+            channels > 8 || sampleRate == 0 || dataSize / (2u * channels) < 2 || ((uintptr_t)data & 1)) {
+            munmap(map, (size_t)st.st_size);
+            continue;
+        }
+        drumSamples[note] = (DrumSample){ (const int16_t *)data, dataSize / (2u * channels), sampleRate,
+                                          (uint8_t)channels, map, (size_t)st.st_size };
+        loaded++;
     }
+    return loaded;
 }
 
-static void note_on(uint8_t note, uint8_t velocity) {
-    if (note >= 128) return;
+// Patch coefficients - note-on only, never per sample
+static inline double note_hz(double note) {
+    return 440.0 * pow(2.0, (note - 69.0) / 12.0);
+}
+
+static inline uint32_t hz_to_phase_inc(double hz) {
+    if (hz > SYNTH_SAMPLE_RATE * 0.49) hz = SYNTH_SAMPLE_RATE * 0.49;
+    return (uint32_t)(hz / SYNTH_SAMPLE_RATE * 4294967296.0);
+}
+
+static inline double time_code_seconds(int code) {
+    return 0.001 * pow(2.0, code / 16.0);
+}
+
+// Per-sample multiplier that falls 60 dB over the coded time
+static inline float decay_coef(int code) {
+    return (float)exp(-6.9 / (time_code_seconds(code) * SYNTH_SAMPLE_RATE));
+}
+
+static inline int wavetable_level(int note) {
+    return note < 0 ? 0 : note / 12 < WAVETABLE_LEVELS ? note / 12 : WAVETABLE_LEVELS - 1;
+}
+
+static void voice_setup_patch(SynthVoice *voice, const SynthPatch *p, uint8_t note, float gain) {
+    double noteB = note + p->detuneB / 100.0;
+    voice->tableA = wavetables[p->waveA][wavetable_level(note)];
+    voice->tableB = wavetables[p->waveB][wavetable_level((int)(noteB + 0.5))];
+    voice->incA = hz_to_phase_inc(note_hz(note));
+    voice->incB = hz_to_phase_inc(note_hz(noteB));
+    voice->levelA = gain * (255 - p->mixB) / 255.0f;
+    voice->levelB = gain * p->mixB / 255.0f;
+    voice->noiseLevel = 0.0f;
+    voice->sweep = 0.0f;
+    voice->sweepCoef = 0.0f;
+    voice->attackStep = (float)(1.0 / (time_code_seconds(p->attack) * SYNTH_SAMPLE_RATE));
+    voice->decayCoef = decay_coef(p->decay);
+    voice->sustain = p->sustain / 255.0f;
+    voice->releaseCoef = decay_coef(p->release);
+    voice->cutoff = (float)note_hz(note + p->cutoff);
+    voice->filterEnv = p->filterEnv / 12.0f;
+    voice->damping = 2.0f - p->resonance * (1.9f / 255.0f);
+    voice->filterMode = FILTER_LOW;
+}
+
+// Sample voice - the sample replaces the oscillators; filter left open.
+// A release of 0 seconds leaves note-off ignored (one-shot drums).
+static void voice_setup_sample(SynthVoice *voice, const int16_t *frames, uint32_t frameCount, uint8_t stride,
+                               double ratio, float level, double release) {
+    voice->sample = frames;
+    voice->samplePos = 0;
+    voice->sampleInc = (uint64_t)(ratio * 4294967296.0);
+    voice->sampleEnd = frameCount;
+    voice->loopStart = voice->loopEnd = 0;
+    voice->loopMode = 0;
+    voice->sampleStride = stride;
+    voice->levelA = level / 32768.0f;
+    voice->levelB = 0.0f;
+    voice->noiseLevel = 0.0f;
+    voice->sweep = 0.0f;
+    voice->attackStep = (float)(1.0 / (0.002 * SYNTH_SAMPLE_RATE));
+    voice->decayCoef = 1.0f;
+    voice->sustain = 1.0f;
+    voice->releaseCoef = release > 0.0 ? (float)exp(-6.9 / ((release < 0.01 ? 0.01 : release) * SYNTH_SAMPLE_RATE)) : 1.0f;
+    voice->cutoff = (float)(SYNTH_SAMPLE_RATE * 0.45);
+    voice->filterEnv = 0.0f;
+    voice->damping = 2.0f;
+    voice->filterMode = FILTER_OFF;
+}
+
+static void voice_setup_zone(SynthVoice *voice, const SF2Zone *z, uint8_t note, float gain) {
+    double cents = (note - z->rootKey) * 100.0 + z->tune;
+    double ratio = z->sampleRate / SYNTH_SAMPLE_RATE * pow(2.0, cents / 1200.0);
+    float level = gain * 2.0f * (float)pow(10.0, -z->attenuation / 200.0);
+    voice_setup_sample(voice, sf2Samples + z->start, z->end - z->start, 1, ratio, level, pow(2.0, z->release / 1200.0));
+    voice->loopStart = z->loopStart - z->start;
+    voice->loopEnd = z->loopEnd - z->start;
+    voice->loopMode = z->loopMode;
+}
+
+// WAV drums play at their recorded pitch, through to the end of the file
+static void voice_setup_wav(SynthVoice *voice, const DrumSample *d, float gain) {
+    voice_setup_sample(voice, d->frames, d->frameCount, d->channels, d->sampleRate / SYNTH_SAMPLE_RATE, gain * 2.0f, 0.0);
+    voice->attackStep = 1.0f;  // Keep the transient
+}
+
+// Drum voices ignore note-off: they decay at the same rate held or released
+static void voice_setup_drum(SynthVoice *voice, uint8_t program, uint8_t note, float gain) {
+    int kit = DRUM_KIT_COUNT - 1;
+    while (kit > 0 && gmDrumKits[kit].program > program) kit--;
+    const DrumKit *k = &gmDrumKits[kit];
+    const DrumSound *d = &gmDrums[note - DRUM_FIRST_NOTE];
+    int pitch = d->pitch + k->tune;
+    int decay = d->decay + k->decay;
+    if (decay < 0) decay = 0;
+
+    voice->tableA = voice->tableB = wavetables[WAVE_TRIANGLE][wavetable_level(pitch + d->sweep)];
+    voice->incA = voice->incB = hz_to_phase_inc(note_hz(pitch));
+    voice->levelA = gain * d->body / 255.0f;
+    voice->levelB = 0.0f;
+    voice->noiseLevel = gain * d->noise / 255.0f;
+    voice->sweep = (float)(pow(2.0, d->sweep / 12.0) - 1.0);
+    voice->sweepCoef = decay_coef(decay - 48);  // Sweep settles well before the body decays
+    voice->attackStep = 1.0f;
+    voice->decayCoef = voice->releaseCoef = decay_coef(decay);
+    voice->sustain = 0.0f;
+    voice->cutoff = (float)note_hz(d->cutoff + k->cutoff);
+    voice->filterEnv = 0.0f;
+    voice->damping = 1.4f;
+    voice->filterMode = d->filterMode;
+}
+
+// Filter coefficients for the envelope level env (cutoff capped below Nyquist)
+static void svf_coefs(SynthVoice *voice, float env) {
+    float fc = voice->cutoff * exp2f(voice->filterEnv * env);
+    if (fc > SYNTH_SAMPLE_RATE * 0.45f) fc = SYNTH_SAMPLE_RATE * 0.45f;
+    float g = tanf((float)M_PI * fc / (float)SYNTH_SAMPLE_RATE);
+    voice->svfG = g;
+    voice->svfA1 = 1.0f / (1.0f + g * (g + voice->damping));
+    voice->svfA2 = g * voice->svfA1;
+}
+
+static void synth_note_on(uint8_t channel, uint8_t note, uint8_t velocity, uint16_t offset) {
+    bool drum = channel == DRUM_CHANNEL;
+    const DrumSample *wav = drum && drumSamples[note].frames ? &drumSamples[note] : NULL;
+    const SF2Zone *zone = wav ? NULL : sf2_find_zone(channel, note, velocity);
+    if (!wav && !zone && drum && (note < DRUM_FIRST_NOTE || note >= DRUM_FIRST_NOTE + DRUM_NOTE_COUNT)) return;
+    int v = voiceMap[channel][note];
+    if (v >= 0) voice_unlink(v);  // Retrigger the voice already on this note
+    else v = voice_alloc();
+
+    SynthVoice *voice = &synthVoices[v];
+    voice->channel = channel;
+    voice->note = note;
+    float gain = (float)velocity * velocity * (0.25f / (127.0f * 127.0f));
+    voice->sample = NULL;
+    if (wav) voice_setup_wav(voice, wav, gain);
+    else if (zone) voice_setup_zone(voice, zone, note, gain);
+    else if (drum) voice_setup_drum(voice, synthPrograms[channel], note, gain);
+    else voice_setup_patch(voice, &gmPatches[synthPrograms[channel]], note, gain);
+    voice->phaseA = voice->phaseB = 0;
+    voice->noise = 0x9E3779B9u ^ (uint32_t)v;
+    voice->env = 0.0f;
+    voice->attacking = true;
+    voice->low = voice->band = 0.0f;
+    voice->finished = false;
+    svf_coefs(voice, 0.0f);
+    voice->startDelay = offset;
+    voice->releaseDelay = 0;
+    voice_link_tail(v, VOICE_HELD);
+    voiceMap[channel][note] = (int8_t)v;
+}
+
+// The voice joins the released list at once (so it is stolen first), but
+// its envelope holds for offset more frames
+static void synth_note_off(uint8_t channel, uint8_t note, uint16_t offset) {
+    int v = voiceMap[channel][note];
+    if (v < 0) return;
+    voiceMap[channel][note] = -1;
+    voice_unlink(v);
+    voice_link_tail(v, VOICE_RELEASED);
+    synthVoices[v].releaseDelay = offset;
+}
+
+static void synth_all_notes_off(uint8_t channel, uint16_t offset) {
+    for (int n = 0; n < 128; n++) synth_note_off(channel, (uint8_t)n, offset);
+}
+
+// Queue - single producer (the main run loop thread: key handler and timers),
+// single consumer (the render thread). Full queue drops the message.
+static void synth_queue_push(uint8_t status, uint8_t data1, uint8_t data2, uint64_t hostTime) {
+    uint32_t head = atomic_load_explicit(&synthQueueHead, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&synthQueueTail, memory_order_acquire);
+    if (head - tail == SYNTH_QUEUE_SIZE) return;
+    synthQueue[head & (SYNTH_QUEUE_SIZE - 1)] = (SynthMessage){ status, data1, data2, hostTime };
+    atomic_store_explicit(&synthQueueHead, head + 1, memory_order_release);
+}
+
+// Strip gain targets: GM volume curves (square law) and constant-power pan,
+// scaled so a centred channel keeps unity gain on each side
+static void strip_targets(SynthStrip *strip) {
+    float volume = strip->volume / 127.0f, expression = strip->expression / 127.0f;
+    float pan = strip->pan ? (strip->pan - 1) / 126.0f : 0.0f;
+    strip->targetLevel = volume * volume * expression * expression;
+    strip->targetL = strip->targetLevel * cosf(pan * (float)M_PI_2) * (float)M_SQRT2;
+    strip->targetR = strip->targetLevel * sinf(pan * (float)M_PI_2) * (float)M_SQRT2;
+}
+
+static void strip_controller(SynthStrip *strip, uint8_t controller, uint8_t value) {
+    switch (controller) {
+        case 7: strip->volume = value; break;
+        case 10: strip->pan = value; break;
+        case 11: strip->expression = value; break;
+        case 121: strip->expression = 127; break;  // Reset all controllers
+        case 91: strip->reverb = value / 127.0f; return;
+        case 93: strip->chorus = value / 127.0f; return;
+        case 94: strip->delay = value / 127.0f; return;
+        default: return;
+    }
+    strip_targets(strip);
+}
+
+// A short decaying triangle an octave above the click's note, at about the
+// level of a drum hit through a strip at its default volume
+static void click_start(uint8_t note, uint8_t velocity, uint16_t offset) {
+    clickTable = wavetables[WAVE_TRIANGLE][wavetable_level(note + 12)];
+    clickInc = hz_to_phase_inc(note_hz(note + 12));
+    clickPhase = 0;
+    clickLevel = (float)velocity * velocity * (0.13f / (127.0f * 127.0f));
+    clickDecay = decay_coef(80);  // About 32 ms
+    clickDelay = offset;
+}
+
+// Apply one message at frame offset of the current block. Notes start and
+// release (All Notes Off included) on their own frame; a program change
+// only matters to later note-ons, which are applied after it in time order,
+// and controllers are smoothed per control block anyway.
+static void synth_apply(const SynthMessage *m, uint16_t offset) {
+    uint8_t channel = m->status & 0x0F;
+    switch (m->status & 0xF0) {
+        case 0x90:
+            if (m->data2) synth_note_on(channel, m->data1, m->data2, offset);
+            else synth_note_off(channel, m->data1, offset);
+            break;
+        case 0x80: synth_note_off(channel, m->data1, offset); break;
+        case 0xB0:
+            if (m->data1 == 123) synth_all_notes_off(channel, offset);
+            else strip_controller(&synthStrips[channel], m->data1, m->data2);
+            break;
+        case 0xC0: synthPrograms[channel] = m->data1 & 0x7F; break;
+        case 0xF0:
+            if (m->status == SYNTH_CLICK) click_start(m->data1, m->data2, offset);
+            break;
+        default: break;
+    }
+}
+
+// Apply a timed message if it falls before blockEnd, else keep it pending.
+// Returns false if it is not due and the pending list is full.
+static bool synth_schedule(const SynthMessage *m, uint64_t blockStart, uint64_t blockEnd, UInt32 frames) {
+    if (m->hostTime >= blockEnd && blockStart) {
+        if (synthPendingCount == SYNTH_PENDING) return false;
+        synthPending[synthPendingCount++] = *m;
+        return true;
+    }
+    uint16_t offset = 0;
+    if (blockStart && m->hostTime > blockStart) {
+        double frame = (double)(m->hostTime - blockStart) / synthMachPerFrame;
+        offset = frame < frames ? (uint16_t)frame : (uint16_t)(frames - 1);
+    }
+    synth_apply(m, offset);
+    return true;
+}
+
+// Start of each block: due pending messages first (they were pushed
+// earlier), then the queue. blockStart is the block's host time (0 = unknown).
+// With the pending list full, the rest stays queued for a later block, so
+// messages are never applied ahead of ones pushed before them.
+static void synth_drain_queue(uint64_t blockStart, UInt32 frames) {
+    uint64_t blockEnd = blockStart + (uint64_t)(frames * synthMachPerFrame);
+    int pending = synthPendingCount;
+    synthPendingCount = 0;
+    for (int i = 0; i < pending; i++) {
+        SynthMessage m = synthPending[i];
+        synth_schedule(&m, blockStart, blockEnd, frames);
+    }
+
+    uint32_t tail = atomic_load_explicit(&synthQueueTail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&synthQueueHead, memory_order_acquire);
+    for (; tail != head; tail++) {
+        const SynthMessage *m = &synthQueue[tail & (SYNTH_QUEUE_SIZE - 1)];
+        if (!m->hostTime) synth_apply(m, 0);
+        else if (!synth_schedule(m, blockStart, blockEnd, frames)) break;
+    }
+    atomic_store_explicit(&synthQueueTail, tail, memory_order_release);
+}
+
+// Wavetable lookup: the top phase bits index the table, the rest interpolate
+// (the table's guard sample makes idx + 1 always valid)
+static inline float wavetable_read(const float *table, uint32_t phase) {
+    uint32_t idx = phase >> WAVETABLE_PHASE_SHIFT;
+    float frac = (float)(phase & WAVETABLE_PHASE_MASK) * (1.0f / (WAVETABLE_PHASE_MASK + 1));
+    return table[idx] + (table[idx + 1] - table[idx]) * frac;
+}
+
+// Voice source - oscillators (or sample), noise and envelope for one control
+// block. Writes every stride-th float so a group's lanes end up interleaved;
+// frames before the note starts or after a one-shot ends are zero.
+static void voice_source(SynthVoice *voice, float *src, float *envOut, UInt32 frames) {
+    UInt32 releaseFrom = frames;  // First frame of the release stage in this block
+    if (voice->list == VOICE_RELEASED) {
+        releaseFrom = voice->releaseDelay < frames ? voice->releaseDelay : frames;
+        voice->releaseDelay -= (uint16_t)releaseFrom;
+    }
+    float env = voice->env;
+    uint32_t phaseA = voice->phaseA, phaseB = voice->phaseB, noise = voice->noise;
+    float sweep = voice->sweep;
+    const int16_t *sample = voice->sample;
+    uint64_t samplePos = voice->samplePos;
+    uint8_t stride = voice->sampleStride;
+
+    UInt32 i = voice->startDelay < frames ? voice->startDelay : frames;
+    voice->startDelay -= (uint16_t)i;
+    for (UInt32 j = 0; j < i; j++) src[j * SYNTH_LANES] = envOut[j * SYNTH_LANES] = 0.0f;
+    for (; i < frames; i++) {
+        bool released = i >= releaseFrom;
+        if (released) {
+            env *= voice->releaseCoef;
+        } else if (voice->attacking) {
+            env += voice->attackStep;
+            if (env >= 1.0f) { env = 1.0f; voice->attacking = false; }
+        } else {
+            env = voice->sustain + (env - voice->sustain) * voice->decayCoef;
+        }
+
+        float in;
+        if (sample) {
+            // Streamed from the mapping with linear interpolation; a finished
+            // one-shot leaves the envelope at zero so the voice is freed
+            uint32_t idx = (uint32_t)(samplePos >> 32);
+            if (voice->loopMode == 1 || (voice->loopMode == 3 && !released)) {
+                while (idx >= voice->loopEnd) {
+                    samplePos -= (uint64_t)(voice->loopEnd - voice->loopStart) << 32;
+                    idx = (uint32_t)(samplePos >> 32);
+                }
+            } else if (idx + 1 >= voice->sampleEnd) {
+                env = 0.0f;
+                voice->attacking = false;
+                voice->sustain = 0.0f;
+                break;
+            }
+            float frac = (float)(uint32_t)samplePos * (1.0f / 4294967296.0f);
+            const int16_t *at = sample + (size_t)idx * stride;
+            in = (at[0] + (at[stride] - at[0]) * frac) * voice->levelA;
+            samplePos += voice->sampleInc;
+        } else {
+            in = wavetable_read(voice->tableA, phaseA) * voice->levelA +
+                 wavetable_read(voice->tableB, phaseB) * voice->levelB;
+        }
+        if (voice->noiseLevel > 0.0f) {
+            noise ^= noise << 13; noise ^= noise >> 17; noise ^= noise << 5;  // xorshift32
+            in += (int32_t)noise * (voice->noiseLevel / 2147483648.0f);
+        }
+        float scale = 1.0f + sweep;
+        phaseA += sweep > 0.0f ? (uint32_t)(voice->incA * scale) : voice->incA;
+        phaseB += voice->incB;
+        sweep *= voice->sweepCoef;
+
+        src[i * SYNTH_LANES] = in;
+        envOut[i * SYNTH_LANES] = env;
+    }
+    for (; i < frames; i++) src[i * SYNTH_LANES] = envOut[i * SYNTH_LANES] = 0.0f;
+
+    voice->env = env;
+    voice->phaseA = phaseA;
+    voice->phaseB = phaseB;
+    voice->noise = noise;
+    voice->sweep = sweep;
+    voice->samplePos = samplePos;
+}
+
+// Filter SYNTH_LANES interleaved voices in place and apply their envelopes.
+// The filter is a trapezoidal state-variable filter (stable at any cutoff
+// and resonance) run on all lanes at once; each lane's coefficients move
+// linearly from the previous block's values to those of the envelope at this
+// block's end, and its mode is a fixed mix of the in / band / low outputs.
+static void filter_lanes(SynthVoice *const *group, int count, float *src, const float *env, UInt32 frames) {
+    float g[SYNTH_LANES] = {0}, a1[SYNTH_LANES] = {0}, a2[SYNTH_LANES] = {0};
+    float dg[SYNTH_LANES] = {0}, da1[SYNTH_LANES] = {0}, da2[SYNTH_LANES] = {0};
+    float mixIn[SYNTH_LANES] = {0}, mixBand[SYNTH_LANES] = {0}, mixLow[SYNTH_LANES] = {0};
+    float s1[SYNTH_LANES] = {0}, s2[SYNTH_LANES] = {0};
+
+    float step = 1.0f / (float)frames;
+    for (int l = 0; l < count; l++) {
+        SynthVoice *voice = group[l];
+        g[l] = voice->svfG;
+        a1[l] = voice->svfA1;
+        a2[l] = voice->svfA2;
+        svf_coefs(voice, voice->env);
+        dg[l] = (voice->svfG - g[l]) * step;
+        da1[l] = (voice->svfA1 - a1[l]) * step;
+        da2[l] = (voice->svfA2 - a2[l]) * step;
+        s1[l] = voice->low;
+        s2[l] = voice->band;
+        switch (voice->filterMode) {
+            case FILTER_BAND: mixBand[l] = 1.0f; break;
+            case FILTER_HIGH: mixIn[l] = 1.0f; mixBand[l] = -voice->damping; mixLow[l] = -1.0f; break;
+            default: mixLow[l] = 1.0f; break;
+        }
+    }
+
+#ifdef TRANSFORM_SIMD
+    vec_f32 vg, va1, va2, vdg, vda1, vda2, vIn, vBand, vLow, vs1, vs2;
+    memcpy(&vg, g, sizeof(vg));
+    memcpy(&va1, a1, sizeof(va1));
+    memcpy(&va2, a2, sizeof(va2));
+    memcpy(&vdg, dg, sizeof(vdg));
+    memcpy(&vda1, da1, sizeof(vda1));
+    memcpy(&vda2, da2, sizeof(vda2));
+    memcpy(&vIn, mixIn, sizeof(vIn));
+    memcpy(&vBand, mixBand, sizeof(vBand));
+    memcpy(&vLow, mixLow, sizeof(vLow));
+    memcpy(&vs1, s1, sizeof(vs1));
+    memcpy(&vs2, s2, sizeof(vs2));
+    for (UInt32 i = 0; i < frames; i++) {
+        vg += vdg;
+        va1 += vda1;
+        va2 += vda2;
+        vec_f32 in, e;
+        memcpy(&in, &src[i * SYNTH_LANES], sizeof(in));
+        memcpy(&e, &env[i * SYNTH_LANES], sizeof(e));
+        vec_f32 band = va1 * vs1 + va2 * (in - vs2);
+        vec_f32 low = vs2 + vg * band;
+        vs1 = 2.0f * band - vs1;
+        vs2 = 2.0f * low - vs2;
+        vec_f32 y = (vIn * in + vBand * band + vLow * low) * e;
+        memcpy(&src[i * SYNTH_LANES], &y, sizeof(y));
+    }
+    memcpy(s1, &vs1, sizeof(vs1));
+    memcpy(s2, &vs2, sizeof(vs2));
+#else
+    for (UInt32 i = 0; i < frames; i++) {
+        for (int l = 0; l < SYNTH_LANES; l++) {
+            g[l] += dg[l];
+            a1[l] += da1[l];
+            a2[l] += da2[l];
+            float in = src[i * SYNTH_LANES + l];
+            float band = a1[l] * s1[l] + a2[l] * (in - s2[l]);
+            float low = s2[l] + g[l] * band;
+            s1[l] = 2.0f * band - s1[l];
+            s2[l] = 2.0f * low - s2[l];
+            src[i * SYNTH_LANES + l] = (mixIn[l] * in + mixBand[l] * band + mixLow[l] * low) * env[i * SYNTH_LANES + l];
+        }
+    }
+#endif
+    for (int l = 0; l < count; l++) {
+        group[l]->low = s1[l];
+        group[l]->band = s2[l];
+    }
+}
+
+// Render up to SYNTH_LANES voices, one per lane, adding each lane into its
+// channel's bus at offset. Open-filter groups (samples) skip the filter and
+// only apply the envelope.
+static void render_group(SynthVoice *const *group, int count, bool filtered, UInt32 offset, UInt32 frames) {
+    float src[SYNTH_BLOCK * SYNTH_LANES] __attribute__((aligned(16)));
+    float env[SYNTH_BLOCK * SYNTH_LANES] __attribute__((aligned(16)));
+    if (count < SYNTH_LANES) {
+        memset(src, 0, sizeof(src));
+        memset(env, 0, sizeof(env));
+    }
+    for (int l = 0; l < count; l++) voice_source(group[l], src + l, env + l, frames);
+
+    if (filtered) {
+        filter_lanes(group, count, src, env, frames);
+    } else {
+        for (UInt32 i = 0; i < frames * SYNTH_LANES; i++) src[i] *= env[i];
+    }
+
+    for (int l = 0; l < count; l++) {
+        float *bus = synthBus[group[l]->channel] + offset;
+        for (UInt32 i = 0; i < frames; i++) bus[i] += src[i * SYNTH_LANES + l];
+    }
+}
+
+// Strips at GM power-on defaults, and the reverb's per-line feedback for a
+// 2.2 s decay (-60 dB after RT60 seconds whatever the line length)
+static void fx_init(void) {
+    for (int c = 0; c < MIDI_TRACKS; c++) {
+        SynthStrip *strip = &synthStrips[c];
+        *strip = (SynthStrip){ .reverb = 40 / 127.0f, .volume = 100, .pan = 64, .expression = 127 };
+        strip_targets(strip);
+        strip->level = strip->targetLevel;
+        strip->gainL = strip->targetL;
+        strip->gainR = strip->targetR;
+    }
+    for (int j = 0; j < FX_REVERB_LINES; j++) {
+        fxReverbGain[j] = (float)pow(10.0, -3.0 * fxReverbLength[j] / (2.2 * SYNTH_SAMPLE_RATE));
+    }
+}
+
+// Reverb - an 8-line feedback delay network. Every line is longer than a
+// control block, so a whole block is read from each line before any of it
+// is written back: the Hadamard mix and the write-back then run as plain
+// loops over frames, which the compiler vectorises.
+static void fx_reverb(const float *in, float *outL, float *outR, UInt32 frames) {
+    float lines[FX_REVERB_LINES][SYNTH_BLOCK] __attribute__((aligned(16)));
+    for (int j = 0; j < FX_REVERB_LINES; j++) {
+        const float *ring = fxReverbRing[j];
+        uint32_t read = fxReverbPos - fxReverbLength[j];
+        float damp = fxReverbDamp[j];
+        for (UInt32 i = 0; i < frames; i++) {
+            damp += (ring[(read + i) & (FX_REVERB_RING - 1)] - damp) * 0.7f;  // High frequencies die first
+            lines[j][i] = damp;
+        }
+        fxReverbDamp[j] = damp;
+    }
+    for (UInt32 i = 0; i < frames; i++) {
+        outL[i] += 0.35f * (lines[0][i] + lines[2][i] + lines[4][i] + lines[6][i]);
+        outR[i] += 0.35f * (lines[1][i] + lines[3][i] + lines[5][i] + lines[7][i]);
+    }
+
+    // Fast Walsh-Hadamard transform across the lines (scaled to stay lossless)
+    for (int h = 1; h < FX_REVERB_LINES; h <<= 1) {
+        for (int j = 0; j < FX_REVERB_LINES; j += h << 1) {
+            for (int k = j; k < j + h; k++) {
+                for (UInt32 i = 0; i < frames; i++) {
+                    float a = lines[k][i], b = lines[k + h][i];
+                    lines[k][i] = a + b;
+                    lines[k + h][i] = a - b;
+                }
+            }
+        }
+    }
+    const float norm = 0.35355339f;  // 1 / sqrt(FX_REVERB_LINES)
+    for (int j = 0; j < FX_REVERB_LINES; j++) {
+        float *ring = fxReverbRing[j];
+        float gain = fxReverbGain[j] * norm;
+        for (UInt32 i = 0; i < frames; i++) {
+            // The tiny offset keeps a decaying tail out of denormals
+            ring[(fxReverbPos + i) & (FX_REVERB_RING - 1)] = in[i] * 0.25f + lines[j][i] * gain + 1e-18f;
+        }
+    }
+    fxReverbPos += frames;
+}
+
+// Chorus - one modulated delay line, two taps a quarter LFO cycle apart for
+// width. The delay ramps linearly across the block from the LFO value at its
+// start to the value at its end.
+static void fx_chorus(const float *in, float *outL, float *outR, UInt32 frames) {
+    const float centre = 0.012f * (float)SYNTH_SAMPLE_RATE, depth = 0.003f * (float)SYNTH_SAMPLE_RATE;
+    float next = fxChorusPhase + (float)(2.0 * M_PI * 0.6 / SYNTH_SAMPLE_RATE) * frames;
+    if (next > (float)(2.0 * M_PI)) next -= (float)(2.0 * M_PI);
+    float delay[2][2] = {
+        { centre + depth * sinf(fxChorusPhase), centre + depth * sinf(next) },
+        { centre + depth * cosf(fxChorusPhase), centre + depth * cosf(next) },
+    };
+    fxChorusPhase = next;
+
+    for (UInt32 i = 0; i < frames; i++) {
+        fxChorusRing[(fxChorusPos + i) & (FX_CHORUS_RING - 1)] = in[i];
+    }
+    float *out[2] = { outL, outR };
+    for (int side = 0; side < 2; side++) {
+        float d = delay[side][0], step = (delay[side][1] - d) / (float)frames;
+        for (UInt32 i = 0; i < frames; i++, d += step) {
+            uint32_t whole = (uint32_t)d;
+            float frac = d - (float)whole;
+            uint32_t idx = fxChorusPos + i - whole;
+            float a = fxChorusRing[idx & (FX_CHORUS_RING - 1)], b = fxChorusRing[(idx - 1) & (FX_CHORUS_RING - 1)];
+            out[side][i] += (a + (b - a) * frac) * 0.5f;
+        }
+    }
+    fxChorusPos += frames;
+}
+
+// Delay - tempo-synced ping-pong: the send enters the left line, and each
+// repeat crosses to the other side. The delay is at least one control block,
+// so reads and writes of a block never overlap.
+static void fx_delay(const float *in, float *outL, float *outR, UInt32 frames) {
+    uint32_t d = atomic_load_explicit(&fxDelayFrames, memory_order_relaxed);
+    if (d < SYNTH_BLOCK) d = SYNTH_BLOCK;
+    if (d > FX_DELAY_RING - SYNTH_BLOCK) d = FX_DELAY_RING - SYNTH_BLOCK;
+    for (UInt32 i = 0; i < frames; i++) {
+        uint32_t read = (fxDelayPos + i - d) & (FX_DELAY_RING - 1);
+        uint32_t write = (fxDelayPos + i) & (FX_DELAY_RING - 1);
+        float l = fxDelayRing[0][read], r = fxDelayRing[1][read];
+        outL[i] += l * 0.5f;
+        outR[i] += r * 0.5f;
+        fxDelayRing[0][write] = in[i] + r * 0.4f + 1e-18f;
+        fxDelayRing[1][write] = l * 0.4f;
+    }
+    fxDelayPos += frames;
+}
+
+// Mark voices whose envelope has decayed (released, or percussive with no
+// sustain) as finished and remove them from list, keeping the rest in order
+static int drop_finished(SynthVoice **list, int count) {
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        SynthVoice *voice = list[i];
+        bool silent = (voice->list == VOICE_RELEASED && !voice->releaseDelay) ||
+                      (voice->sustain == 0.0f && !voice->attacking);
+        if (silent && voice->env < 1e-4f && !voice->startDelay) voice->finished = true;
+        else list[kept++] = voice;
+    }
+    return kept;
+}
+
+// Render every voice of the given channels for a pass of frames, in control
+// blocks of SYNTH_BLOCK. Each channel's voices are always visited in the
+// same order (filtered, then open, by voice index), so a bus sums to the
+// same bits whichever thread renders it.
+static void render_channels(uint16_t channels, UInt32 frames) {
+    SynthVoice *filtered[SYNTH_VOICES], *open[SYNTH_VOICES];
+    int filteredCount = 0, openCount = 0;
+    uint64_t active = ~voiceFreeMask;
+    while (active) {
+        SynthVoice *voice = &synthVoices[__builtin_ctzll(active)];
+        active &= active - 1;
+        if (!(channels & (1u << voice->channel))) continue;
+        if (voice->filterMode == FILTER_OFF) open[openCount++] = voice;
+        else filtered[filteredCount++] = voice;
+    }
+
+    for (UInt32 done = 0; done < frames; done += SYNTH_BLOCK) {
+        UInt32 block = frames - done < SYNTH_BLOCK ? frames - done : SYNTH_BLOCK;
+        for (int i = 0; i < filteredCount; i += SYNTH_LANES) {
+            int n = filteredCount - i < SYNTH_LANES ? filteredCount - i : SYNTH_LANES;
+            render_group(filtered + i, n, true, done, block);
+        }
+        for (int i = 0; i < openCount; i += SYNTH_LANES) {
+            int n = openCount - i < SYNTH_LANES ? openCount - i : SYNTH_LANES;
+            render_group(open + i, n, false, done, block);
+        }
+
+        filteredCount = drop_finished(filtered, filteredCount);
+        openCount = drop_finished(open, openCount);
+    }
+}
+
+// Render worker - sleeps on its semaphore, renders the channels it was dealt
+// for the pass, then counts itself out. Time-constraint scheduling keeps it
+// on a core alongside the audio thread; the affinity tag asks the kernel to
+// spread workers over separate L2 caches (macOS has no hard pinning).
+static void *render_worker(void *arg) {
+    int t = (int)(intptr_t)arg;
+    thread_act_t thread = pthread_mach_thread_np(pthread_self());
+    uint32_t period = (uint32_t)(512 * synthMachPerFrame);
+    thread_time_constraint_policy_data_t timing = { period, period / 4, period / 2, 1 };
+    thread_policy_set(thread, THREAD_TIME_CONSTRAINT_POLICY, (thread_policy_t)&timing,
+                      THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+    thread_affinity_policy_data_t affinity = { t + 1 };
+    thread_policy_set(thread, THREAD_AFFINITY_POLICY, (thread_policy_t)&affinity, THREAD_AFFINITY_POLICY_COUNT);
+
+    for (;;) {
+        semaphore_wait(synthWake[t]);
+        if (atomic_load_explicit(&synthWorkersQuit, memory_order_acquire)) break;
+        render_channels(synthThreadChannels[t], synthPassFrames);
+        atomic_fetch_sub_explicit(&synthPassPending, 1, memory_order_release);
+    }
+    return NULL;
+}
+
+// One render thread per online core up to SYNTH_MAX_THREADS, or the count in
+// SYNTH_THREADS_ENV; falls back to rendering on the audio thread alone
+static void render_workers_start(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *env = getenv(SYNTH_THREADS_ENV);
+    int count = env ? atoi(env) : (int)cores;
+    if (count < 1) count = 1;
+    if (count > SYNTH_MAX_THREADS) count = SYNTH_MAX_THREADS;
+
+    synthThreadCount = 1;
+    for (int t = 1; t < count; t++) {
+        if (semaphore_create(mach_task_self(), &synthWake[t], SYNC_POLICY_FIFO, 0) != KERN_SUCCESS) break;
+        if (pthread_create(&synthWorkers[t], NULL, render_worker, (void *)(intptr_t)t) != 0) {
+            semaphore_destroy(mach_task_self(), synthWake[t]);
+            break;
+        }
+        synthThreadCount = t + 1;
+    }
+}
+
+static void render_workers_stop(void) {
+    atomic_store_explicit(&synthWorkersQuit, true, memory_order_release);
+    for (int t = 1; t < synthThreadCount; t++) semaphore_signal(synthWake[t]);
+    for (int t = 1; t < synthThreadCount; t++) {
+        pthread_join(synthWorkers[t], NULL);
+        semaphore_destroy(mach_task_self(), synthWake[t]);
+    }
+    synthThreadCount = 1;
+}
+
+// Render all active voices for a pass into the channel buses and return the
+// channels that had voices. With enough voices, whole channels are dealt to
+// the least-loaded thread (busiest channels first); the workers are woken,
+// the audio thread renders its own share, then spins until every worker has
+// counted out. Finished voices are freed here, after the barrier.
+static uint16_t render_pass(UInt32 frames) {
+    int load[MIDI_TRACKS] = {0}, voices = 0;
+    uint64_t active = ~voiceFreeMask;
+    while (active) {
+        load[synthVoices[__builtin_ctzll(active)].channel]++;
+        active &= active - 1;
+        voices++;
+    }
+    uint16_t channels = 0;
+    for (int c = 0; c < MIDI_TRACKS; c++) {
+        if (load[c]) channels |= (uint16_t)(1u << c);
+    }
+
+    int threads = voices >= SYNTH_PARALLEL_VOICES ? synthThreadCount : 1;
+    if (threads > 1) {
+        int threadLoad[SYNTH_MAX_THREADS] = {0};
+        memset(synthThreadChannels, 0, sizeof(synthThreadChannels));
+        for (uint16_t left = channels; left;) {
+            int busiest = __builtin_ctz(left);
+            for (int c = busiest + 1; c < MIDI_TRACKS; c++) {
+                if ((left & (1u << c)) && load[c] > load[busiest]) busiest = c;
+            }
+            left &= (uint16_t)~(1u << busiest);
+            int t = 0;
+            for (int i = 1; i < threads; i++) {
+                if (threadLoad[i] < threadLoad[t]) t = i;
+            }
+            threadLoad[t] += load[busiest];
+            synthThreadChannels[t] |= (uint16_t)(1u << busiest);
+        }
+        synthPassFrames = frames;
+        atomic_store_explicit(&synthPassPending, threads - 1, memory_order_release);
+        for (int t = 1; t < threads; t++) semaphore_signal(synthWake[t]);
+        render_channels(synthThreadChannels[0], frames);
+        while (atomic_load_explicit(&synthPassPending, memory_order_acquire) > 0) {
+#if defined(__aarch64__)
+            __asm__ volatile("yield");
+#elif defined(__x86_64__)
+            __asm__ volatile("pause");
+#endif
+        }
+    } else {
+        render_channels(channels, frames);
+    }
+
+    active = ~voiceFreeMask;
+    while (active) {
+        int v = __builtin_ctzll(active);
+        active &= active - 1;
+        if (synthVoices[v].finished) voice_free(v);
+    }
+    return channels;
+}
+
+// The metronome click, straight into the dry output
+static void click_render(float *outL, float *outR, UInt32 frames) {
+    if (clickLevel < 1e-4f) return;
+    UInt32 i = clickDelay < frames ? clickDelay : frames;
+    clickDelay -= (uint16_t)i;
+    for (; i < frames; i++) {
+        float x = wavetable_read(clickTable, clickPhase) * clickLevel;
+        clickPhase += clickInc;
+        clickLevel *= clickDecay;
+        outL[i] += x;
+        outR[i] += x;
+    }
+}
+
+// Channel buses to the stereo output: each active channel adds to the dry
+// mix and to the three sends (cost per channel, not per voice), then each
+// effect runs once on its send. Strip gains ramp linearly across the block
+// toward their targets (about 10 ms to settle), and the same loop takes the
+// strip's peak for its meter; a silent strip's gains jump to their targets.
+static void synth_mix(uint16_t channels, UInt32 offset, float *outL, float *outR, UInt32 frames) {
+    float reverb[SYNTH_BLOCK] = {0}, chorus[SYNTH_BLOCK] = {0}, delay[SYNTH_BLOCK] = {0};
+    memset(outL, 0, frames * sizeof(float));
+    memset(outR, 0, frames * sizeof(float));
+    for (int c = 0; c < MIDI_TRACKS; c++) {
+        SynthStrip *strip = &synthStrips[c];
+        if (!(channels & (1u << c))) {
+            strip->level = strip->targetLevel;
+            strip->gainL = strip->targetL;
+            strip->gainR = strip->targetR;
+            strip->meter *= 0.9967f;  // About -20 dB per second
+            atomic_store_explicit(&synthMeters[c], strip->meter, memory_order_relaxed);
+            continue;
+        }
+
+        float step = 1.0f / (float)frames;
+        float level = strip->level, gainL = strip->gainL, gainR = strip->gainR;
+        strip->level += (strip->targetLevel - level) * 0.15f;
+        strip->gainL += (strip->targetL - gainL) * 0.15f;
+        strip->gainR += (strip->targetR - gainR) * 0.15f;
+        float dLevel = (strip->level - level) * step;
+        float dL = (strip->gainL - gainL) * step, dR = (strip->gainR - gainR) * step;
+        float peak = 0.0f;
+        float *bus = synthBus[c] + offset;
+        for (UInt32 i = 0; i < frames; i++) {
+            float x = bus[i];
+            level += dLevel;
+            gainL += dL;
+            gainR += dR;
+            float l = x * gainL, r = x * gainR, send = x * level;
+            outL[i] += l;
+            outR[i] += r;
+            reverb[i] += send * strip->reverb;
+            chorus[i] += send * strip->chorus;
+            delay[i] += send * strip->delay;
+            peak = fmaxf(peak, fmaxf(fabsf(l), fabsf(r)));
+            bus[i] = 0.0f;
+        }
+        strip->meter = fmaxf(peak, strip->meter * 0.9967f);
+        atomic_store_explicit(&synthMeters[c], strip->meter, memory_order_relaxed);
+    }
+    click_render(outL, outR, frames);
+    fx_reverb(reverb, outL, outR, frames);
+    fx_chorus(chorus, outL, outR, frames);
+    fx_delay(delay, outL, outR, frames);
+}
+
+// Render callback (mixer input bus 1) - apply queued messages, then render
+// in passes of up to SYNTH_MAX_FRAMES: every active voice is rendered into
+// its channel bus (in parallel across channels, see render_pass), then the
+// buses are mixed to stereo with the sends in control blocks of SYNTH_BLOCK.
+static OSStatus synth_render(void *inRefCon, AudioUnitRenderActionFlags *ioActionFlags,
+                             const AudioTimeStamp *inTimeStamp, UInt32 inBusNumber,
+                             UInt32 inNumberFrames, AudioBufferList *ioData) {
+    // Messages pushed from now on land in the next block at the earliest; the
+    // lead allows one more block so a late timer still makes its frame
+    uint64_t blockStart = 0;
+    if (inTimeStamp && (inTimeStamp->mFlags & kAudioTimeStampHostTimeValid)) {
+        blockStart = inTimeStamp->mHostTime;
+        uint64_t next = blockStart + (uint64_t)(2 * inNumberFrames * synthMachPerFrame);
+        uint64_t now = mach_absolute_time();
+        atomic_store_explicit(&synthLeadMach, next > now ? next - now : 0, memory_order_relaxed);
+    }
+    synth_drain_queue(blockStart, inNumberFrames);
+
+    float *left = (float *)ioData->mBuffers[0].mData;
+    float *right = ioData->mNumberBuffers > 1 ? (float *)ioData->mBuffers[1].mData : NULL;
+
+    for (UInt32 pass = 0; pass < inNumberFrames; pass += SYNTH_MAX_FRAMES) {
+        UInt32 passFrames = inNumberFrames - pass < SYNTH_MAX_FRAMES ? inNumberFrames - pass : SYNTH_MAX_FRAMES;
+        uint16_t channels = render_pass(passFrames);
+        for (UInt32 done = 0; done < passFrames; done += SYNTH_BLOCK) {
+            UInt32 frames = passFrames - done < SYNTH_BLOCK ? passFrames - done : SYNTH_BLOCK;
+            float *outL = left + pass + done;
+            float outR[SYNTH_BLOCK];
+            synth_mix(channels, done, outL, right ? right + pass + done : outR, frames);
+            if (!right) {
+                for (UInt32 i = 0; i < frames; i++) outL[i] = 0.5f * (outL[i] + outR[i]);
+            }
+        }
+    }
+    return noErr;
+}
+
+static bool init_audio(void) {
+    OSStatus err;
+    err = NewAUGraph(&graph);
+    if (err) return false;
+
+    AudioComponentDescription cd = {0};
+    cd.componentType = kAudioUnitType_MusicDevice;
+    cd.componentSubType = kAudioUnitSubType_DLSSynth;
+    cd.componentManufacturer = kAudioUnitManufacturer_Apple;
+
+    err = AUGraphAddNode(graph, &cd, &synthNode);
+    if (err) return false;
+
+    AUNode outputNode;
+    cd.componentType = kAudioUnitType_Output;
+    cd.componentSubType = kAudioUnitSubType_DefaultOutput;
+
+    err = AUGraphAddNode(graph, &cd, &outputNode);
+    if (err) return false;
+
+    // Mixer: bus 0 = DLS synth, bus 1 = native engine render callback
+    cd.componentType = kAudioUnitType_Mixer;
+    cd.componentSubType = kAudioUnitSubType_MultiChannelMixer;
+    err = AUGraphAddNode(graph, &cd, &mixerNode);
+    if (err) return false;
+
+    err = AUGraphConnectNodeInput(graph, synthNode, 0, mixerNode, 0);
+    if (err) return false;
+    err = AUGraphConnectNodeInput(graph, mixerNode, 0, outputNode, 0);
+    if (err) return false;
+
+    err = AUGraphOpen(graph);
+    if (err) return false;
+
+    err = AUGraphNodeInfo(graph, synthNode, NULL, &synthUnit);
+    if (err) return false;
+
+    AudioUnit mixerUnit;
+    err = AUGraphNodeInfo(graph, mixerNode, NULL, &mixerUnit);
+    if (err) return false;
+    UInt32 busCount = 2;
+    err = AudioUnitSetProperty(mixerUnit, kAudioUnitProperty_ElementCount, kAudioUnitScope_Input, 0,
+                               &busCount, sizeof(busCount));
+    if (err) return false;
+
+    AudioStreamBasicDescription format = {0};
+    format.mSampleRate = SYNTH_SAMPLE_RATE;
+    format.mFormatID = kAudioFormatLinearPCM;
+    format.mFormatFlags = kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+    format.mBytesPerPacket = sizeof(float);
+    format.mFramesPerPacket = 1;
+    format.mBytesPerFrame = sizeof(float);
+    format.mChannelsPerFrame = 2;
+    format.mBitsPerChannel = 32;
+    err = AudioUnitSetProperty(mixerUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 1,
+                               &format, sizeof(format));
+    if (err) return false;
+
+    AURenderCallbackStruct callback = { synth_render, NULL };
+    err = AUGraphSetNodeInputCallback(graph, mixerNode, 1, &callback);
+    if (err) return false;
+
+    err = AUGraphInitialize(graph);
+    if (err) return false;
+
+    err = AUGraphStart(graph);
+    if (err) return false;
+
+    return true;
+}
+
+// MIDI Output initialization
+static bool init_midi_output(void) {
+    OSStatus status = MIDIClientCreate(CFSTR("terminalMIDI"), NULL, NULL, &midiClient);
+    if (status != noErr) return false;
+
+    status = MIDIOutputPortCreate(midiClient, CFSTR("Output"), &midiOutPort);
+    if (status != noErr) return false;
+
+    // Enumerate MIDI destinations
+    ItemCount destCount = MIDIGetNumberOfDestinations();
+    midiDestCount = 0;
+
+    for (ItemCount i = 0; i < destCount && midiDestCount < MAX_MIDI_DESTINATIONS; i++) {
+        MIDIEndpointRef dest = MIDIGetDestination(i);
+        if (dest) {
+            midiDestinations[midiDestCount] = dest;
+
+            // Get destination name
+            CFStringRef name = NULL;
+            MIDIObjectGetStringProperty(dest, kMIDIPropertyName, &name);
+            if (name) {
+                CFStringGetCString(name, midiDestNames[midiDestCount], 64, kCFStringEncodingUTF8);
+                CFRelease(name);
+            } else {
+                snprintf(midiDestNames[midiDestCount], 64, "MIDI Output %d", midiDestCount + 1);
+            }
+            midiDestCount++;
+        }
+    }
+
+    return true;
+}
+
+// Select MIDI output destination (0 = internal synth, 1-9 = external)
+static void select_midi_output(int index) {
+    if (index == 0) {
+        selectedOutput = 0;  // Internal synth
+    } else if (index > 0 && index <= midiDestCount) {
+        selectedOutput = index;  // External MIDI destination
+    } else {
+        return;  // Invalid selection, ignore
+    }
+    update_status_display();
+}
+
+// Send MIDI to external destination
+static void send_midi_to_output(uint8_t status, uint8_t data1, uint8_t data2) {
+    if (selectedOutput == 0 || selectedOutput > midiDestCount) return;
+
+    MIDIEndpointRef dest = midiDestinations[selectedOutput - 1];
+    Byte buffer[64];
+    MIDIPacketList *packetList = (MIDIPacketList *)buffer;
+    MIDIPacket *packet = MIDIPacketListInit(packetList);
+
+    Byte midiData[3] = {status, data1, data2};
+    packet = MIDIPacketListAdd(packetList, sizeof(buffer), packet, 0, 3, midiData);
+
+    if (packet) {
+        MIDISend(midiOutPort, dest, packetList);
+    }
+}
+
+// Internal synth - the DLS synth, or the native engine's message queue.
+// Native messages are stamped with the host time they belong to (a sequenced
+// event's scheduled time, else now) plus the output lead - the same lead as
+// the metronome - so each one sounds on its own frame, a fixed latency after
+// its time, rather than at the start of whichever block drains it. A
+// channel's stamps never go backwards, so a note-off cannot overtake its
+// note-on when the lead shrinks.
+static void internal_midi_event_at(uint8_t status, uint8_t data1, uint8_t data2, uint64_t when) {
+    if (nativeSynth) {
+        uint64_t lead = atomic_load_explicit(&synthLeadMach, memory_order_relaxed);
+        uint64_t stamp = 0;
+        if (lead) {
+            uint64_t *last = &synthChannelStamp[status & 0x0F];
+            stamp = (when ? when : mach_absolute_time()) + lead;
+            if (stamp < *last) stamp = *last;
+            *last = stamp;
+        }
+        synth_queue_push(status, data1, data2, stamp);
+    } else if (synthUnit) {
+        MusicDeviceMIDIEvent(synthUnit, status, data1, data2, 0);
+    }
+}
+
+static void internal_midi_event(uint8_t status, uint8_t data1, uint8_t data2) {
+    internal_midi_event_at(status, data1, data2, 0);
+}
+
+// Toggle the internal output between the DLS synth and the native engine,
+// silencing the one being left
+static void toggle_native_synth(void) {
+    for (int ch = 0; ch < 16; ch++) internal_midi_event(0xB0 | ch, 123, 0);
+    nativeSynth = !nativeSynth;
+    for (int t = 0; t < MIDI_TRACKS; t++) send_track_mix(t);
+    memset(heldNoteChannel, -1, sizeof(heldNoteChannel));
+    memset(playingNotes, 0, sizeof(playingNotes));
+    update_status_display();
+}
+
+// MIDI functions - route to internal synth OR external MIDI based on selection.
+// when is the event's scheduled host time (0 = now).
+static void note_on_internal(int channel, uint8_t note, uint8_t velocity, uint64_t when) {
+    if (note >= 128) return;
+
+    if (selectedOutput == 0) {
+        // Internal synth
+        internal_midi_event_at(0x90 | channel, note, velocity, when);
+    } else {
+        // External MIDI
+        send_midi_to_output(0x90 | channel, note, velocity);
+    }
+}
+
+static void note_off_internal(int channel, uint8_t note, uint64_t when) {
+    if (note >= 128) return;
+
+    if (selectedOutput == 0) {
+        // Internal synth
+        internal_midi_event_at(0x80 | channel, note, 0, when);
+    } else {
+        // External MIDI - use note-on with velocity 0 for better compatibility
+        send_midi_to_output(0x90 | channel, note, 0);
+    }
+}
+
+// Capture - O(1), allocation-free; overwrites the oldest entry when full
+static void capture_push(uint8_t status, int channel, uint8_t note, uint8_t velocity) {
+    CaptureEvent *ev = &captureRing[captureHead & (CAPTURE_RING_SIZE - 1)];
+    ev->machTime = mach_absolute_time();
+    ev->songTick = clockRunning ? get_song_tick() : UINT64_MAX;
+    ev->status = status;
+    ev->note = note;
+    ev->velocity = velocity;
+    ev->channel = (uint8_t)channel;
+    captureHead++;
+}
+
+// Punch range in track ticks: the loop region, or the whole loop without one
+static void punch_range(uint32_t len, uint32_t *lo, uint32_t *hi) {
+    *lo = 0;
+    *hi = len;
+    if (recordMode == RECORD_PUNCH && region_active()) {
+        uint32_t barTicks = (uint32_t)beatsPerBar * TICKS_PER_BEAT;
+        *lo = (uint32_t)regionStartBar * barTicks;
+        *hi = (uint32_t)regionEndBar * barTicks;
+        if (*hi > len) *hi = len;
+    }
+}
+
+// Remove the old (pre-pass) notes starting in [from, to), clipped to the punch
+// range. Old notes are sorted, so this is two binary searches and one memmove.
+static void take_erase_range(MIDITrack *track, uint32_t from, uint32_t to) {
+    uint32_t lo, hi;
+    punch_range(track_loop_ticks(track), &lo, &hi);
+    if (from < lo) from = lo;
+    if (to > hi) to = hi;
+    if (from >= to) return;
+
+    int first = find_note_index(track->notes, takeBase, from);
+    int last = find_note_index(track->notes, takeBase, to);
+    int removed = last - first;
+    if (removed == 0) return;
+
+    memmove(&track->notes[first], &track->notes[last], (track->noteCount - last) * sizeof(MIDINote));
+    track->noteCount -= removed;
+    takeBase -= removed;
+}
+
+static void take_index_open_notes(const MIDITrack *track) {
+    for (int n = 0; n < 128; n++) openNote[takeChannel][n] = -1;
+    for (int i = 0; i < track->noteCount; i++) {
+        if (track->notes[i].length == 0) openNote[takeChannel][track->notes[i].note] = (int16_t)i;
+    }
+}
+
+// Erase the old notes under what the playhead has covered in this pass (the
+// range may wrap past the loop end); open notes are re-indexed
+static void take_erase_covered(void) {
+    MIDITrack *track = &tracks[takeChannel];
+    uint32_t len = track_loop_ticks(track);
+    uint32_t end = takeStartTick + takeCovered;
+    int count = track->noteCount;
+    if (takeCovered >= len) {
+        take_erase_range(track, 0, len);
+    } else if (end <= len) {
+        take_erase_range(track, takeStartTick, end);
+    } else {
+        take_erase_range(track, takeStartTick, len);
+        take_erase_range(track, 0, end - len);
+    }
+    if (track->noteCount != count) take_index_open_notes(track);
+}
+
+// End the pass (loop wrap, relocate or stop): erase what it covered from the
+// track's notes and takes, then make this pass's notes the old notes of the
+// next one (sorted, open notes re-indexed)
+static void take_flush(void) {
+    if (takeChannel < 0) return;
+    MIDITrack *track = &tracks[takeChannel];
+    take_erase_covered();
+    take_trim_takes(track);
+    takeCovered = 0;
+    sort_notes(track->notes, track->noteCount);
+    take_index_open_notes(track);
+    takeBase = track->noteCount;
+    track->dirty = true;
+}
+
+// Replace / punch take - begins at the current playhead of the recording track
+static void take_begin(int channel) {
+    MIDITrack *track = &tracks[channel];
+    sort_notes(track->notes, track->noteCount);
+    track->dirty = true;
+    takeChannel = channel;
+    takeBase = track->noteCount;
+    takeStartTick = track->playPos;
+    takeCovered = 0;
+}
+
+static void take_end(void) {
+    take_flush();
+    takeChannel = -1;
+}
+
+// The playhead advanced over the take track. Only the covered length grows:
+// the old notes it passed are muted (take_mutes) and left out of rebuilt
+// events, and are erased once, when the pass ends.
+static void take_advance(uint32_t delta, uint32_t len) {
+    takeCovered += delta;
+    if (takeCovered >= len) {
+        // The next pass begins where this one did (takeStartTick is unchanged)
+        uint32_t over = takeCovered - len;
+        take_flush();
+        takeCovered = over;
+    }
+}
+
+// Whether a note of track t starting at tick is replaced by the take in
+// progress: only the part of the punch range the playhead has covered in this
+// pass is muted (its old notes are erased when the pass ends)
+static inline bool take_mutes(int t, uint32_t tick) {
+    if (takeChannel < 0 || t != takeChannel) return false;
+    uint32_t len = track_loop_ticks(&tracks[t]);
+    uint32_t lo, hi;
+    punch_range(len, &lo, &hi);
+    if (tick < lo || tick >= hi) return false;
+    uint32_t offset = tick >= takeStartTick ? tick - takeStartTick : tick + len - takeStartTick;
+    return offset < takeCovered;
+}
+
+// Record a note-on: append an open note (length 0) and remember it by pitch
+static void record_note_on(int channel, uint8_t note, uint8_t velocity) {
+    MIDITrack *track = &tracks[channel];
+    if (openNote[channel][note] >= 0) return;
+    // A full track being replaced frees what the pass has covered so far
+    if (channel == takeChannel && track_note_total(track) >= MAX_NOTES_PER_TRACK) {
+        take_erase_covered();
+        take_trim_takes(track);
+    }
+    if (track_note_total(track) >= MAX_NOTES_PER_TRACK) return;
+
+    uint32_t tick = get_track_tick(track);  // Raw - quantize is applied at playback
+    if (channel == takeChannel) {
+        uint32_t lo, hi;
+        punch_range(track_loop_ticks(track), &lo, &hi);
+        if (tick < lo || tick >= hi) return;  // Outside the punch range
+    }
+    MIDINote *n = &track->notes[track->noteCount];
+    n->start = tick;
+    n->length = 0;
+    n->note = note;
+    n->velocity = velocity;
+    openNote[channel][note] = (int16_t)track->noteCount++;
+    openNoteSongTick[channel][note] = get_song_tick();
+}
+
+// Close an open note - O(1) via the open-note table. Length comes from the song
+// position, so notes held across the loop wrap keep their real duration.
+static void record_note_off(int channel, uint8_t note) {
+    int idx = openNote[channel][note];
+    if (idx < 0) return;
+    openNote[channel][note] = -1;
+
+    MIDITrack *track = &tracks[channel];
+    uint64_t held = get_song_tick() - openNoteSongTick[channel][note];
+    uint32_t len = track_loop_ticks(track);
+    if (held < 1) held = 1;
+    if (held > len) held = len;
+    track->notes[idx].length = (uint32_t)held;
+    track->dirty = true;
+
+    uint8_t pitch = note;
+    transpose_notes(&pitch, 1, track->transpose);  // As it will be rebuilt
+    recordedNotes[channel][pitch >> 6] |= 1ull << (pitch & 63);
+}
+
+// Close every note still held when recording ends (no hanging notes)
+static void close_open_notes(void) {
+    for (int ch = 0; ch < MIDI_TRACKS; ch++) {
+        for (int n = 0; n < 128; n++) {
+            if (openNote[ch][n] >= 0) record_note_off(ch, (uint8_t)n);
+        }
+    }
+}
+
+static void note_on(uint8_t note, uint8_t velocity) {
+    if (note >= 128) return;
+
+    note_on_internal(currentChannel, note, velocity, 0);
+    heldNoteChannel[note] = currentChannel;
+    if (!recording) capture_push(0x90, currentChannel, note, velocity);
+
+    // Record if recording
+    if (recording && clockRunning) {
+        record_note_on(currentChannel, note, velocity);
+    }
+}
+
+static void note_off(uint8_t note) {
+    if (note >= 128 || heldNoteChannel[note] < 0) return;
+
+    int channel = heldNoteChannel[note];
+    note_off_internal(channel, note, 0);
+    heldNoteChannel[note] = -1;
+    if (!recording) capture_push(0x80, channel, note, 0);
+
+    // Record if recording
+    if (recording && clockRunning) {
+        record_note_off(channel, note);
+    }
+}
+
+static void all_notes_off(void) {
+    for (int i = 0; i < 128; i++) {
+        if (heldNoteChannel[i] >= 0) {
+            note_off_internal(heldNoteChannel[i], i, 0);
+            heldNoteChannel[i] = -1;
+        }
+    }
+}
+
+// Panic - send All Notes Off (CC 123) on all 16 MIDI channels
+static void midi_panic(void) {
+    for (int ch = 0; ch < 16; ch++) {
+        if (selectedOutput == 0) {
+            internal_midi_event(0xB0 | ch, 123, 0);
+        } else {
+            send_midi_to_output(0xB0 | ch, 123, 0);
+        }
+    }
+    memset(heldNoteChannel, -1, sizeof(heldNoteChannel));
+    update_status_display();
+}
+
+// Mixer - a track is heard unless muted, or another track is soloed and it
+// is not. Mute and solo go out as CC7 0, so they work on every output.
+static bool track_audible(int t) {
+    if (tracks[t].mute) return false;
+    for (int i = 0; i < MIDI_TRACKS; i++) {
+        if (tracks[i].solo) return tracks[t].solo;
+    }
+    return true;
+}
+
+static void send_track_mix(int t) {
+    uint8_t volume = track_audible(t) ? tracks[t].volume : 0;
+    if (selectedOutput == 0) {
+        internal_midi_event(0xB0 | t, 7, volume);
+        internal_midi_event(0xB0 | t, 10, tracks[t].pan);
+    } else {
+        send_midi_to_output(0xB0 | t, 7, volume);
+        send_midi_to_output(0xB0 | t, 10, tracks[t].pan);
+    }
+}
+
+static void set_track_volume(int volume) {
+    if (volume < 0) volume = 0;
+    if (volume > 127) volume = 127;
+    tracks[currentChannel].volume = (uint8_t)volume;
+    send_track_mix(currentChannel);
+    update_status_display();
+}
+
+static void set_track_pan(int pan) {
+    if (pan < 0) pan = 0;
+    if (pan > 127) pan = 127;
+    tracks[currentChannel].pan = (uint8_t)pan;
+    send_track_mix(currentChannel);
+    update_status_display();
+}
+
+// Mute and solo change which tracks are audible - resend every volume
+static void toggle_track_mute(void) {
+    tracks[currentChannel].mute = !tracks[currentChannel].mute;
+    for (int t = 0; t < MIDI_TRACKS; t++) send_track_mix(t);
+    update_status_display();
+}
+
+static void toggle_track_solo(void) {
+    tracks[currentChannel].solo = !tracks[currentChannel].solo;
+    for (int t = 0; t < MIDI_TRACKS; t++) send_track_mix(t);
+    update_status_display();
+}
+
+static void program_change(int program) {
+    if (recording) return;  // Can't change during recording
+    tracks[currentChannel].program = program;
+    if (selectedOutput == 0) {
+        internal_midi_event(0xC0 | currentChannel, program, 0);
+    } else {
+        send_midi_to_output(0xC0 | currentChannel, program, 0);
+    }
+    update_status_display();
+}
+
+static void channel_change(int channel) {
+    if (recording) return;  // Can't change during recording
+    // Send note-off for all 128 notes on the channel we're leaving
+    for (int i = 0; i < 128; i++) {
+        if (selectedOutput == 0) {
+            internal_midi_event(0x80 | currentChannel, i, 0);
+        } else {
+            // Use note-on with velocity 0 for better compatibility
+            send_midi_to_output(0x90 | currentChannel, i, 0);
+        }
+    }
+    // Clear held note tracking for notes on this channel
+    for (int i = 0; i < 128; i++) {
+        if (heldNoteChannel[i] == currentChannel) {
+            heldNoteChannel[i] = -1;
+        }
+    }
+    currentChannel = channel;
+    // Apply program for this channel
+    if (selectedOutput == 0) {
+        internal_midi_event(0xC0 | currentChannel, tracks[currentChannel].program, 0);
+    } else {
+        send_midi_to_output(0xC0 | currentChannel, tracks[currentChannel].program, 0);
+    }
+    update_status_display();
+}
+
+// Undo - chunk pool. Chunks are written once when allocated and never again
+// while referenced.
+static void undo_init(void) {
+    for (int i = 0; i < UNDO_CHUNK_POOL; i++) undoChunkFree[i] = (uint16_t)(UNDO_CHUNK_POOL - 1 - i);
+    undoChunkFreeCount = UNDO_CHUNK_POOL;
+}
+
+static inline int snapshot_chunk_count(const TrackSnapshot *s) {
+    return (s->noteCount + UNDO_CHUNK_NOTES - 1) / UNDO_CHUNK_NOTES;
+}
+
+static void snapshot_retain(const TrackSnapshot *s) {
+    for (int c = 0; c < snapshot_chunk_count(s); c++) undoChunkRefs[s->chunks[c]]++;
+}
+
+static void snapshot_release(const TrackSnapshot *s) {
+    for (int c = 0; c < snapshot_chunk_count(s); c++) {
+        uint16_t id = s->chunks[c];
+        if (--undoChunkRefs[id] == 0) undoChunkFree[undoChunkFreeCount++] = id;
+    }
+}
+
+static void undo_drop_oldest(void) {
+    UndoEntry *e = &undoHistory[undoFirst];
+    snapshot_release(&e->before);
+    snapshot_release(&e->after);
+    undoFirst = (undoFirst + 1) % UNDO_LEVELS;
+    undoCount--;
+    undoCursor--;
+}
+
+// A free chunk, forgetting the oldest levels if the pool is exhausted; false
+// only if the current snapshots alone fill the pool (ruled out by its size)
+_Static_assert(UNDO_CHUNK_POOL >= (MIDI_TRACKS + 1) * UNDO_CHUNKS_PER_TRACK,
+               "undo pool must hold every track's current snapshot plus one more");
+static bool undo_chunk_alloc(uint16_t *id) {
+    while (undoChunkFreeCount == 0 && undoCount > 0) undo_drop_oldest();
+    if (undoChunkFreeCount == 0) return false;
+    *id = undoChunkFree[--undoChunkFreeCount];
+    return true;
+}
+
+// Snapshot a track, sharing each chunk whose notes are unchanged from prev.
+// The snapshot holds a reference to each of its chunks (none if it fails).
+static bool snapshot_capture(int t, const TrackSnapshot *prev, TrackSnapshot *out) {
+    const MIDITrack *track = &tracks[t];
+    int prevChunks = snapshot_chunk_count(prev);
+    memset(out, 0, sizeof(*out));
+    for (int c = 0, base = 0; base < track->noteCount; c++, base += UNDO_CHUNK_NOTES) {
+        int n = track->noteCount - base < UNDO_CHUNK_NOTES ? track->noteCount - base : UNDO_CHUNK_NOTES;
+        const MIDINote *src = &track->notes[base];
+        uint16_t id;
+        if (c < prevChunks && memcmp(undoChunkNotes[prev->chunks[c]], src, n * sizeof(MIDINote)) == 0) {
+            id = prev->chunks[c];
+        } else {
+            if (!undo_chunk_alloc(&id)) {
+                out->noteCount = base;
+                snapshot_release(out);
+                return false;
+            }
+            memcpy(undoChunkNotes[id], src, n * sizeof(MIDINote));
+        }
+        undoChunkRefs[id]++;
+        out->chunks[c] = id;
+    }
+    out->noteCount = track->noteCount;
+    out->loopBars = track->loopBars;
+    out->quantizeGrid = track->quantizeGrid;
+    out->quantizeSwing = track->quantizeSwing;
+    out->quantizeStrength = track->quantizeStrength;
+    out->transpose = track->transpose;
+    out->velocityTrim = track->velocityTrim;
+    memcpy(out->takes, track->takes, sizeof(out->takes));
+    out->takeCount = track->takeCount;
+    memcpy(out->compMask, track->compMask, sizeof(out->compMask));
+    return true;
+}
+
+// Bring track t from snapshot 'from' (its state now) to 'to'. Only chunks that
+// differ are copied, so the cost follows the size of the edit, not the history.
+static void snapshot_restore(int t, const TrackSnapshot *from, const TrackSnapshot *to) {
+    MIDITrack *track = &tracks[t];
+    int fromChunks = snapshot_chunk_count(from);
+    for (int c = 0, base = 0; base < to->noteCount; c++, base += UNDO_CHUNK_NOTES) {
+        int n = to->noteCount - base < UNDO_CHUNK_NOTES ? to->noteCount - base : UNDO_CHUNK_NOTES;
+        int had = c < fromChunks ? from->noteCount - base : 0;
+        if (c < fromChunks && from->chunks[c] == to->chunks[c] && had >= n) continue;
+        memcpy(&track->notes[base], undoChunkNotes[to->chunks[c]], n * sizeof(MIDINote));
+    }
+    track->noteCount = to->noteCount;
+    track->loopBars = to->loopBars;
+    track->quantizeGrid = to->quantizeGrid;
+    track->quantizeSwing = to->quantizeSwing;
+    track->quantizeStrength = to->quantizeStrength;
+    track->transpose = to->transpose;
+    track->velocityTrim = to->velocityTrim;
+    memcpy(track->takes, to->takes, sizeof(track->takes));
+    track->takeCount = to->takeCount;
+    memcpy(track->compMask, to->compMask, sizeof(track->compMask));
+    track->playPos = (uint32_t)(get_song_tick() % track_loop_ticks(track));
+    track->dirty = true;
+}
+
+// Record an edit of track t as (state at its last edit, state now). A new edit
+// discards anything that was undone. Edits made while recording the track are
+// folded into the pass, which is committed when recording stops.
+static void undo_commit(int t) {
+    if (recording && t == currentChannel) return;
+    while (undoCount > undoCursor) {
+        UndoEntry *e = &undoHistory[(undoFirst + --undoCount) % UNDO_LEVELS];
+        snapshot_release(&e->before);
+        snapshot_release(&e->after);
+    }
+    if (undoCount == UNDO_LEVELS) undo_drop_oldest();
+
+    TrackSnapshot after;
+    if (!snapshot_capture(t, &undoCurrent[t], &after)) return;
+    if (memcmp(&after, &undoCurrent[t], sizeof(after)) == 0) {
+        snapshot_release(&after);  // Nothing changed
+        return;
+    }
+    UndoEntry *e = &undoHistory[(undoFirst + undoCount) % UNDO_LEVELS];
+    e->track = t;
+    e->before = undoCurrent[t];  // Takes over the current snapshot's references
+    e->after = after;
+    snapshot_retain(&after);
+    undoCurrent[t] = after;
+    undoCount++;
+    undoCursor++;
+}
+
+// Undo / redo - step the cursor and restore one track from its snapshot
+static void undo_step(bool redo) {
+    if (recording) return;  // Can't undo during recording
+    if (redo ? undoCursor == undoCount : undoCursor == 0) return;
+    UndoEntry *e = &undoHistory[(undoFirst + (redo ? undoCursor++ : --undoCursor)) % UNDO_LEVELS];
+    const TrackSnapshot *to = redo ? &e->after : &e->before;
+
+    release_track_notes(e->track);
+    snapshot_restore(e->track, &undoCurrent[e->track], to);
+    snapshot_retain(to);
+    snapshot_release(&undoCurrent[e->track]);
+    undoCurrent[e->track] = *to;
+
+    printf("\r\033[K%s track %d (%d/%d)", redo ? "Redo" : "Undo", e->track + 1, undoCursor, undoCount);
+    fflush(stdout);
+}
+
+static void clear_current_track(void) {
+    if (recording) return;  // Can't clear during recording
+    MIDITrack *track = &tracks[currentChannel];
+    track->noteCount = 0;
+    track->takeCount = 0;
+    memset(track->compMask, 0, sizeof(track->compMask));
+    track->dirty = true;
+    undo_commit(currentChannel);  // The arena keeps the takes for undo
+    update_status_display();
+}
+
+// Arena compaction - every take header (tracks, current snapshots and undo
+// levels) is visited by take_arena_visit. Takes are whole arena slices that
+// are either shared exactly or disjoint, so the live slices are marked by
+// their first note, slid down in order, and each header is then re-pointed.
+static void take_arena_visit(void (*visit)(Take *take)) {
+    for (int t = 0; t < MIDI_TRACKS; t++) {
+        for (int k = 0; k < tracks[t].takeCount; k++) visit(&tracks[t].takes[k]);
+        for (int k = 0; k < undoCurrent[t].takeCount; k++) visit(&undoCurrent[t].takes[k]);
+    }
+    for (int i = 0; i < undoCount; i++) {
+        UndoEntry *e = &undoHistory[(undoFirst + i) % UNDO_LEVELS];
+        for (int k = 0; k < e->before.takeCount; k++) visit(&e->before.takes[k]);
+        for (int k = 0; k < e->after.takeCount; k++) visit(&e->after.takes[k]);
+    }
+}
+
+static void take_mark_live(Take *take) {
+    if (take->count) takeArenaMap[take->first] = take->count;
+}
+
+static void take_repoint(Take *take) {
+    if (take->count) take->first = takeArenaMap[take->first];
+}
+
+static void take_arena_compact(void) {
+    memset(takeArenaMap, 0, takeArenaUsed * sizeof(uint32_t));
+    take_arena_visit(take_mark_live);
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < takeArenaUsed;) {
+        uint32_t count = takeArenaMap[i];
+        if (count == 0) { i++; continue; }
+        memmove(&takeArena[used], &takeArena[i], count * sizeof(MIDINote));
+        takeArenaMap[i] = used;
+        used += count;
+        i += count;
+    }
+    take_arena_visit(take_repoint);
+    takeArenaUsed = used;
+}
+
+// Seal the overdub pass in progress into a take: its notes are copied once to
+// the end of the arena and the take plays in every bar, layered like an
+// overdub. A full arena is compacted first; without room even then, the pass
+// simply stays in the track's own notes.
+static void take_store(void) {
+    if (overdubBase < 0) return;
+    MIDITrack *track = &tracks[currentChannel];
+    uint32_t count = (uint32_t)(track->noteCount - overdubBase);
+    overdubBase = -1;
+    if (count == 0 || track->takeCount >= MAX_TAKES_PER_TRACK) return;
+    if (takeArenaUsed + count > TAKE_ARENA_NOTES) take_arena_compact();
+    if (takeArenaUsed + count > TAKE_ARENA_NOTES) return;
+
+    Take *take = &track->takes[track->takeCount];
+    take->first = takeArenaUsed;
+    take->count = count;
+    memcpy(&takeArena[takeArenaUsed], &track->notes[track->noteCount - count], count * sizeof(MIDINote));
+    takeArenaUsed += count;
+    track->noteCount -= (int)count;
+
+    uint16_t bit = (uint16_t)(1u << track->takeCount++);
+    for (int b = 0; b < MAX_LOOP_BARS; b++) track->compMask[b] |= bit;
+    track->dirty = true;
+}
+
+// Replace / punch over takes: a take with notes under the range the pass
+// covered is re-pointed to a trimmed copy at the end of the arena (undo levels
+// keep the original slice). A full arena is compacted first; without room even
+// then, the take's comped notes move into the track's own notes, as far as
+// they fit, and the take is emptied.
+static void take_trim_takes(MIDITrack *track) {
+    uint32_t barTicks = (uint32_t)beatsPerBar * TICKS_PER_BEAT;
+    for (int k = 0; k < track->takeCount; k++) {
+        Take *take = &track->takes[k];
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < take->count; i++) {
+            kept += !take_mutes(takeChannel, takeArena[take->first + i].start);
+        }
+        if (kept == take->count) continue;
+
+        if (takeArenaUsed + kept > TAKE_ARENA_NOTES) take_arena_compact();
+        bool room = takeArenaUsed + kept <= TAKE_ARENA_NOTES;
+        uint32_t first = takeArenaUsed;
+        for (uint32_t i = 0; i < take->count; i++) {
+            const MIDINote *note = &takeArena[take->first + i];
+            if (take_mutes(takeChannel, note->start)) continue;
+            if (room) {
+                takeArena[takeArenaUsed++] = *note;
+            } else if (note->start / barTicks < MAX_LOOP_BARS &&
+                       (track->compMask[note->start / barTicks] & (1u << k)) &&
+                       track->noteCount < MAX_NOTES_PER_TRACK) {
+                track->notes[track->noteCount++] = *note;
+            }
+        }
+        take->first = room ? first : 0;
+        take->count = room ? kept : 0;
+    }
+}
+
+// Bar of the current track under the playhead (or where the clock will start)
+static int track_current_bar(const MIDITrack *track) {
+    uint32_t barTicks = (uint32_t)beatsPerBar * TICKS_PER_BEAT;
+    uint32_t pos = clockRunning ? track->playPos
+                                : (uint32_t)locateBar * barTicks % track_loop_ticks(track);
+    return (int)(pos / barTicks);
+}
+
+// Comp the current bar of the current track: play only take k (1-based), or
+// every take (0). Only that bar's mask changes; the track's index is rebuilt.
+static void comp_take(int k) {
+    MIDITrack *track = &tracks[currentChannel];
+    if (track->takeCount == 0 || k > track->takeCount) return;
+    uint16_t mask = k ? (uint16_t)(1u << (k - 1)) : (uint16_t)((1u << track->takeCount) - 1);
+    track->compMask[track_current_bar(track)] = mask;
+    track->dirty = true;
+    undo_commit(currentChannel);
+    update_status_display();
+}
 
-    note_on_internal(currentChannel, note, velocity);
-    heldNoteChannel[note] = currentChannel;
+// Commit the capture ring into the current track. Notes played with the clock
+// running keep their loop position; notes played while stopped are aligned so
+// the first one lands on the downbeat. Only complete notes from the last
+// CAPTURE_SECONDS (and at most one track loop, in song ticks or, with the clock
+// stopped, in wall time) on the current channel are taken.
+static void capture_commit(void) {
+    if (recording) return;  // Can't commit during recording
+    MIDITrack *track = &tracks[currentChannel];
+    uint32_t len = track_loop_ticks(track);
+    uint64_t window = (uint64_t)CAPTURE_SECONDS * 1000000000ull * timebaseInfo.denom / timebaseInfo.numer;
+    uint64_t now = mach_absolute_time();
 
-    // Record if recording
-    if (recording && clockRunning) {
-        MIDITrack *track = &tracks[currentChannel];
-        if (track->eventCount < MAX_EVENTS_PER_TRACK) {
-            uint32_t tick = get_current_tick();
-            // Quantize to 16th notes if enabled
-            if (quantizeEnabled) {
-                tick = ((tick + TICKS_PER_16TH / 2) / TICKS_PER_16TH) * TICKS_PER_16TH;
-                tick = tick % totalLoopTicks;
-            }
-            track->events[track->eventCount].tick = tick;
-            track->events[track->eventCount].status = 0x90;
-            track->events[track->eventCount].note = note;
-            track->events[track->eventCount].velocity = velocity;
-            track->eventCount++;
+    uint32_t first = captureCommitted;
+    if (captureHead - first > CAPTURE_RING_SIZE) first = captureHead - CAPTURE_RING_SIZE;
+
+    // Oldest usable entry: inside the time window, captured in the same clock
+    // state as the newest, and within one loop of it
+    uint64_t loopWall = tempo_tick_to_mach(len);
+    uint64_t newestTick = 0, newestMach = 0;
+    bool haveNewest = false;
+    for (uint32_t i = captureHead; i != first; i--) {
+        CaptureEvent *ev = &captureRing[(i - 1) & (CAPTURE_RING_SIZE - 1)];
+        if (ev->channel != currentChannel) continue;
+        if (!haveNewest) {
+            newestTick = ev->songTick;
+            newestMach = ev->machTime;
+            haveNewest = true;
+        }
+        if (now - ev->machTime > window) { first = i; break; }
+        if ((ev->songTick == UINT64_MAX) != (newestTick == UINT64_MAX)) { first = i; break; }
+        if (newestTick == UINT64_MAX) {
+            if (newestMach - ev->machTime >= loopWall) { first = i; break; }
+        } else if (newestTick - ev->songTick >= len) {
+            first = i;
+            break;
         }
     }
-}
 
-static void note_off(uint8_t note) {
-    if (note >= 128 || heldNoteChannel[note] < 0) return;
-
-    int channel = heldNoteChannel[note];
-    note_off_internal(channel, note);
-    heldNoteChannel[note] = -1;
+    // Pair note-ons with note-offs; orphans at either end of the window are dropped
+    uint32_t onTick[128];
+    uint64_t onSongTick[128];
+    uint64_t onMach[128];
+    uint8_t onVelocity[128];
+    bool isOpen[128] = {false};
+    uint64_t baseMach = 0;
+    bool haveBase = false;
+    int added = 0;
+    int room = MAX_NOTES_PER_TRACK - track_note_total(track);
+
+    for (uint32_t i = first; i != captureHead; i++) {
+        CaptureEvent *ev = &captureRing[i & (CAPTURE_RING_SIZE - 1)];
+        if (ev->channel != currentChannel) continue;
+        if (!haveBase) { baseMach = ev->machTime; haveBase = true; }
+
+        uint32_t tick;
+        if (ev->songTick != UINT64_MAX) {
+            tick = (uint32_t)(ev->songTick % len);
+        } else {
+            uint64_t offset = (ev->machTime - baseMach) % loopMach;
+            tick = tempo_mach_to_tick(offset) % len;
+        }
 
-    // Record if recording
-    if (recording && clockRunning) {
-        MIDITrack *track = &tracks[channel];
-        if (track->eventCount < MAX_EVENTS_PER_TRACK) {
-            uint32_t tick = get_current_tick();
-            // Quantize to 16th notes if enabled
-            if (quantizeEnabled) {
-                tick = ((tick + TICKS_PER_16TH / 2) / TICKS_PER_16TH) * TICKS_PER_16TH;
-                tick = tick % totalLoopTicks;
+        if (ev->status == 0x90) {
+            isOpen[ev->note] = true;
+            onTick[ev->note] = tick;
+            onSongTick[ev->note] = ev->songTick;
+            onMach[ev->note] = ev->machTime;
+            onVelocity[ev->note] = ev->velocity;
+        } else if (isOpen[ev->note]) {
+            isOpen[ev->note] = false;
+            if (added >= room) break;
+
+            // Length from the song position, or from wall time if the clock was stopped
+            uint64_t held;
+            if (ev->songTick != UINT64_MAX) {
+                held = ev->songTick - onSongTick[ev->note];
+            } else {
+                uint64_t machHeld = ev->machTime - onMach[ev->note];
+                held = (machHeld >= loopMach) ? len : tempo_mach_to_tick(machHeld);
             }
-            track->events[track->eventCount].tick = tick;
-            track->events[track->eventCount].status = 0x80;
-            track->events[track->eventCount].note = note;
-            track->events[track->eventCount].velocity = 0;
-            track->eventCount++;
+            if (held < 1) held = 1;
+            if (held > len) held = len;
+
+            MIDINote *n = &track->notes[track->noteCount++];
+            n->start = onTick[ev->note];
+            n->length = (uint32_t)held;
+            n->note = ev->note;
+            n->velocity = onVelocity[ev->note];
+            added++;
         }
     }
+
+    track->dirty = true;
+    undo_commit(currentChannel);
+    captureCommitted = captureHead;
+    printf("\r\033[KCaptured %d notes into track %d", added, currentChannel + 1);
+    fflush(stdout);
 }
 
-static void all_notes_off(void) {
-    for (int i = 0; i < 128; i++) {
-        if (heldNoteChannel[i] >= 0) {
-            note_off_internal(heldNoteChannel[i], i);
-            heldNoteChannel[i] = -1;
+// Playback - play one track's events from its cursor up to endTick, which is
+// song tick endSong; each event is sent with the host time it was due at.
+// Tracks are kept sorted, so this touches only the events actually played.
+static void play_track_until(int t, uint32_t endTick, uint64_t endSong) {
+    MIDITrack *track = &tracks[t];
+    int i = track->playIndex;
+    while (i < track->eventCount && track->events[i].tick < endTick) {
+        MIDIEvent *ev = &track->events[i++];
+        uint64_t bit = 1ull << (ev->note & 63);
+        uint64_t when = song_tick_to_mach(endSong - (endTick - ev->tick));
+        if (ev->status == 0x90) {
+            if (take_mutes(t, ev->tick)) continue;  // Being replaced by the take
+            note_on_internal(t, ev->note, ev->velocity, when);
+            playingNotes[t][ev->note >> 6] |= bit;
+        } else if (ev->status == 0x80) {
+            // A replaced track drops the note-offs of the note-ons it muted
+            if (t == takeChannel && !(playingNotes[t][ev->note >> 6] & bit)) continue;
+            note_off_internal(t, ev->note, when);
+            playingNotes[t][ev->note >> 6] &= ~bit;
         }
     }
+    track->playIndex = i;
 }
 
-// Panic - send All Notes Off (CC 123) on all 16 MIDI channels
-static void midi_panic(void) {
-    for (int ch = 0; ch < 16; ch++) {
-        if (selectedOutput == 0) {
-            if (synthUnit) {
-                MusicDeviceMIDIEvent(synthUnit, 0xB0 | ch, 123, 0, 0);
-            }
-        } else {
-            send_midi_to_output(0xB0 | ch, 123, 0);
+// Send note-off for every note playback left sounding on a track
+static void release_track_notes(int t) {
+    for (int w = 0; w < 2; w++) {
+        uint64_t bits = playingNotes[t][w];
+        while (bits) {
+            note_off_internal(t, (uint8_t)(w * 64 + __builtin_ctzll(bits)), 0);
+            bits &= bits - 1;
         }
+        playingNotes[t][w] = 0;
     }
-    memset(heldNoteChannel, -1, sizeof(heldNoteChannel));
-    update_status_display();
 }
 
-static void program_change(int program) {
-    if (recording) return;  // Can't change during recording
-    tracks[currentChannel].program = program;
-    if (selectedOutput == 0) {
-        if (synthUnit) {
-            MusicDeviceMIDIEvent(synthUnit, 0xC0 | currentChannel, program, 0, 0);
-        }
-    } else {
-        send_midi_to_output(0xC0 | currentChannel, program, 0);
-    }
-    update_status_display();
+static void release_playing_notes(void) {
+    for (int t = 0; t < MIDI_TRACKS; t++) release_track_notes(t);
 }
 
-static void channel_change(int channel) {
-    if (recording) return;  // Can't change during recording
-    // Send note-off for all 128 notes on the channel we're leaving
-    for (int i = 0; i < 128; i++) {
-        if (selectedOutput == 0) {
-            if (synthUnit) {
-                MusicDeviceMIDIEvent(synthUnit, 0x80 | currentChannel, i, 0, 0);
-            }
+// Pitches sounding at pos, and the velocity each was started with: the bar's
+// snapshot, advanced over the bar's events before the cursor idx. Notes ending
+// exactly at pos are not sounding (their note-off sorts first).
+static void track_sounding(const MIDITrack *track, int idx, uint32_t pos,
+                           uint64_t sounding[2], uint8_t velocity[128]) {
+    int n = track->eventCount;
+    sounding[0] = sounding[1] = 0;
+    if (n == 0) return;
+
+    int bar = (int)(pos / ((uint32_t)beatsPerBar * TICKS_PER_BEAT));
+    sounding[0] = track->barSounding[bar][0];
+    sounding[1] = track->barSounding[bar][1];
+    memcpy(velocity, track->barVelocity[bar], 128);
+    for (int i = track->barIndex[bar]; i < idx; i++) {
+        const MIDIEvent *ev = &track->events[i];
+        uint64_t bit = 1ull << (ev->note & 63);
+        if (ev->status == 0x90) {
+            sounding[ev->note >> 6] |= bit;
+            velocity[ev->note] = ev->velocity;
         } else {
-            // Use note-on with velocity 0 for better compatibility
-            send_midi_to_output(0x90 | currentChannel, i, 0);
+            sounding[ev->note >> 6] &= ~bit;
         }
     }
-    // Clear held note tracking for notes on this channel
-    for (int i = 0; i < 128; i++) {
-        if (heldNoteChannel[i] == currentChannel) {
-            heldNoteChannel[i] = -1;
-        }
+    for (int i = idx; i < n && track->events[i].tick == pos && track->events[i].status == 0x80; i++) {
+        sounding[track->events[i].note >> 6] &= ~(1ull << (track->events[i].note & 63));
     }
-    currentChannel = channel;
-    // Apply program for this channel
-    if (selectedOutput == 0) {
-        if (synthUnit) {
-            MusicDeviceMIDIEvent(synthUnit, 0xC0 | currentChannel, tracks[currentChannel].program, 0, 0);
+}
+
+// Chase - position a track at pos: binary-search the cursor and start every
+// note sounding there (bounded by one bar of events)
+static void chase_track(int t, uint32_t pos) {
+    MIDITrack *track = &tracks[t];
+    track->playPos = pos;
+    if (track->dirty) {
+        track_build_events(track);
+        track->dirty = false;
+    }
+    recordedNotes[t][0] = recordedNotes[t][1] = 0;
+    int idx = find_event_index(track, pos);
+    track->playIndex = idx;
+
+    uint64_t sounding[2];
+    uint8_t velocity[128];
+    track_sounding(track, idx, pos, sounding, velocity);
+    for (int w = 0; w < 2; w++) {
+        for (uint64_t bits = sounding[w]; bits; bits &= bits - 1) {
+            int note = w * 64 + __builtin_ctzll(bits);
+            note_on_internal(t, (uint8_t)note, velocity[note], 0);
         }
-    } else {
-        send_midi_to_output(0xC0 | currentChannel, tracks[currentChannel].program, 0);
+        playingNotes[t][w] |= sounding[w];
     }
-    update_status_display();
 }
 
-static void clear_current_track(void) {
-    if (recording) return;  // Can't clear during recording
-    tracks[currentChannel].eventCount = 0;
-    update_status_display();
+// Rebuild a playing track after an edit and chase only what the edit changed:
+// a note playback started keeps sounding while its pitch still sounds at the
+// cursor (its note-off comes from the new events), and is released otherwise
+// (moved, shortened or transposed away). A pitch that now sounds is started,
+// unless it was just recorded - the player sounded that one live.
+static void rechase_track(int t) {
+    MIDITrack *track = &tracks[t];
+    track_build_events(track);
+    track->dirty = false;
+    int idx = find_event_index(track, track->playPos);
+    track->playIndex = idx;
+
+    uint64_t sounding[2];
+    uint8_t velocity[128];
+    track_sounding(track, idx, track->playPos, sounding, velocity);
+    for (int w = 0; w < 2; w++) {
+        uint64_t start = sounding[w] & ~playingNotes[t][w] & ~recordedNotes[t][w];
+        for (uint64_t bits = playingNotes[t][w] & ~sounding[w]; bits; bits &= bits - 1) {
+            note_off_internal(t, (uint8_t)(w * 64 + __builtin_ctzll(bits)), 0);
+        }
+        for (uint64_t bits = start; bits; bits &= bits - 1) {
+            int note = w * 64 + __builtin_ctzll(bits);
+            note_on_internal(t, (uint8_t)note, velocity[note], 0);
+        }
+        playingNotes[t][w] = (playingNotes[t][w] & sounding[w]) | start;
+        recordedNotes[t][w] = 0;
+    }
 }
 
-// Playback - play recorded events for a tick range
-static void play_events_in_range(uint32_t startTick, uint32_t endTick) {
+// High-resolution playback timer callback
+// Each track advances its own cursor by the song-tick delta and wraps at its own
+// loop length, so tracks of different lengths play polymetrically.
+static void play_tracks_until(uint64_t songTick) {
+    if (songTick <= lastSongTick) return;
+    uint64_t delta = songTick - lastSongTick;
+    lastSongTick = songTick;
+
     for (int t = 0; t < MIDI_TRACKS; t++) {
         MIDITrack *track = &tracks[t];
-        for (int i = 0; i < track->eventCount; i++) {
-            MIDIEvent *ev = &track->events[i];
-            bool inRange;
-            if (startTick <= endTick) {
-                inRange = (ev->tick >= startTick && ev->tick < endTick);
-            } else {
-                // Wrapped around
-                inRange = (ev->tick >= startTick || ev->tick < endTick);
-            }
+        uint32_t len = track_loop_ticks(track);
+        if (t == takeChannel) take_advance((uint32_t)(delta < len ? delta : len), len);
+        if (delta >= len) {
+            // Stalled for a whole track loop - chase at the new position rather than burst-play
+            release_track_notes(t);
+            chase_track(t, (uint32_t)(songTick % len));
+            continue;
+        }
 
-            if (inRange) {
-                if (ev->status == 0x90) {
-                    note_on_internal(t, ev->note, ev->velocity);
-                } else if (ev->status == 0x80) {
-                    note_off_internal(t, ev->note);
-                }
-            }
+        track_prepare(track);
+        uint32_t from = track->playPos;
+        uint32_t to = from + (uint32_t)delta;
+        if (to >= len) to -= len;
+        track->playPos = to;
+
+        if (track->eventCount == 0) continue;
+        if (to < from) {
+            // Wrapped - play from cursor to end, then 0 to new cursor
+            play_track_until(t, len, songTick - to);
+            track->playIndex = 0;
         }
+        play_track_until(t, to, songTick);
     }
 }
 
-// High-resolution playback timer callback
 static void playback_tick(CFRunLoopTimerRef timer, void *info) {
     if (!clockRunning) return;
-
-    uint32_t currentTick = get_current_tick();
-
-    // Handle wrap-around
-    if (currentTick < lastPlaybackTick) {
-        // We've wrapped - play events from lastPlaybackTick to end, then 0 to currentTick
-        play_events_in_range(lastPlaybackTick, totalLoopTicks);
-        play_events_in_range(0, currentTick);
-        playbackWrapped = true;
-    } else {
-        // Normal case - play events in range
-        play_events_in_range(lastPlaybackTick, currentTick);
-    }
-
-    lastPlaybackTick = currentTick;
+    play_tracks_until(get_song_tick());
 }
 
 // Calculate optimal playback timer interval based on tempo
@@ -577,7 +3751,7 @@ static double calculate_playback_interval(void) {
     // Seconds per tick = 60 / (BPM * TICKS_PER_BEAT)
     // Use half the tick duration to ensure we check twice per tick
     // Clamp between 1ms (high tempo) and 5ms (low tempo) for efficiency
-    double secsPerTick = 60.0 / (metronomeBPM * TICKS_PER_BEAT);
+    double secsPerTick = 60.0 / (tempoMaxBPM * TICKS_PER_BEAT);
     double interval = secsPerTick * 0.5;
     if (interval < 0.001) interval = 0.001;  // Min 1ms
     if (interval > 0.005) interval = 0.005;  // Max 5ms
@@ -612,22 +3786,37 @@ static void stop_playback_timer(void) {
 static void beat_tick(CFRunLoopTimerRef timer, void *info) {
     if (!clockRunning) return;
 
-    int beatInBar = currentBeat % BEATS_PER_BAR;
+    // Loop region - on reaching B, this (already scheduled) beat becomes A.
+    // Events up to B that playback has not polled yet are played first.
+    // Only timer-driven beats wrap; start and locate call in directly.
+    if (timer && region_active() && currentBeat == (regionEndBar * beatsPerBar) % totalBeats) {
+        play_tracks_until(loopCount * totalLoopTicks + (uint64_t)regionEndBar * beatsPerBar * TICKS_PER_BEAT);
+        relocate_transport((uint32_t)(regionStartBar * beatsPerBar * TICKS_PER_BEAT), nextBeatMachTime, true);
+    }
+
+    int beatInBar = currentBeat % beatsPerBar;
 
     // Reset loop timing on beat 1 BEFORE metronome plays
     // This ensures the downbeat is at tick 0 of the master clock
+    // (anchored to the scheduled downbeat so timer latency never accumulates)
     if (currentBeat == 0) {
-        loopStartTime = mach_absolute_time();
-        lastPlaybackTick = 0;
-        playbackWrapped = false;
+        loopStartTime = nextLoopStartTime;
+        loopStartFrac = nextLoopStartFrac;
+        loopCount = nextLoopCount;
     }
 
     // Metronome - now properly aligned with beat 1
-    // Only play on internal synth (channel 9 = drums)
+    // Only play on internal synth. The native engine's click has its own path
+    // past the mixer strips (track mute, solo and volume do not silence it)
+    // and starts at the beat's own time plus the output lead (the lead
+    // sequenced notes get too), so timer latency never moves it off the
+    // downbeat. Until the render callback runs, the DLS wood blocks play.
     if (metronomeEnabled && selectedOutput == 0 && synthUnit) {
         uint8_t velocity = (beatInBar == 0) ? 120 : 80;
         uint8_t note = (beatInBar == 0) ? 76 : 77;  // Hi/Lo wood block
-        MusicDeviceMIDIEvent(synthUnit, 0x99, note, velocity, 0);
+        uint64_t lead = atomic_load_explicit(&synthLeadMach, memory_order_relaxed);
+        if (lead) synth_queue_push(SYNTH_CLICK, note, velocity, nextBeatMachTime + lead);
+        else MusicDeviceMIDIEvent(synthUnit, 0x99, note, velocity, 0);
     }
 
     // Start recording if armed (recording starts on this beat)
@@ -640,10 +3829,11 @@ static void beat_tick(CFRunLoopTimerRef timer, void *info) {
         stop_recording();
     }
 
-    // Count beats while recording, auto-stop after 16 beats
-    if (recording) {
+    // Count beats while recording, auto-stop after one full loop of the track
+    // (replace and punch takes keep overwriting until recording is stopped)
+    if (recording && takeChannel < 0) {
         beatsRecorded++;
-        if (beatsRecorded > TOTAL_BEATS) {
+        if (beatsRecorded > track_loop_beats(&tracks[currentChannel])) {
             stop_recording();
         }
     }
@@ -652,7 +3842,7 @@ static void beat_tick(CFRunLoopTimerRef timer, void *info) {
     update_status_display();
 
     // Advance beat counter
-    currentBeat = (currentBeat + 1) % TOTAL_BEATS;
+    if (++currentBeat == totalBeats) currentBeat = 0;
 
     schedule_next_beat();
 }
@@ -666,8 +3856,16 @@ static void schedule_next_beat(void) {
     }
 
     if (clockRunning) {
-        // Calculate next beat time in mach ticks (drift-corrected)
-        nextBeatMachTime += nanos_to_mach(nanosPerBeat);
+        // Next beat time from the tempo map, relative to the loop downbeat (drift-corrected).
+        // Downbeats advance a fixed-point phase accumulator, exact over any session length.
+        if (currentBeat == 0) {
+            nextLoopStartFrac = loopStartFrac;
+            nextLoopStartTime = loop_start_after(loopStartTime, &nextLoopStartFrac);
+            nextLoopCount = loopCount + 1;
+            nextBeatMachTime = nextLoopStartTime;
+        } else {
+            nextBeatMachTime = loopStartTime + tempo_tick_to_mach((uint32_t)currentBeat * TICKS_PER_BEAT);
+        }
 
         // Convert mach time delta to seconds for CFRunLoopTimer
         uint64_t now = mach_absolute_time();
@@ -692,11 +3890,18 @@ static void start_clock(void) {
     uint64_t now = mach_absolute_time();
     clockStartTime = now;
     loopStartTime = now;
+    loopStartFrac = 0;
+    nextLoopStartTime = now;
+    nextLoopStartFrac = 0;
+    loopCount = 0;
+    nextLoopCount = 0;
     nextBeatMachTime = now;  // Initialize for drift-corrected scheduling
-    lastPlaybackTick = 0;
-    playbackWrapped = false;
     update_timing_constants();
 
+    // Start from the locate bar, chasing notes already sounding there
+    if (locateBar >= loopBars) locateBar = 0;
+    relocate_transport((uint32_t)(locateBar * beatsPerBar * TICKS_PER_BEAT), now, false);
+
     // Start high-resolution playback timer
     start_playback_timer();
 
@@ -707,16 +3912,23 @@ static void start_clock(void) {
 static void stop_clock(void) {
     if (!clockRunning) return;
 
+    if (recording) {
+        close_open_notes();
+        take_end();
+        take_store();
+        recording = false;
+        undo_commit(currentChannel);
+    }
     clockRunning = false;
+    memset(playingNotes, 0, sizeof(playingNotes));  // Cleared by All Notes Off below
+    memset(recordedNotes, 0, sizeof(recordedNotes));
     recording = false;
     currentBeat = 0;
 
     // Send All Notes Off (CC 123) on all 16 MIDI channels
     for (int ch = 0; ch < 16; ch++) {
         if (selectedOutput == 0) {
-            if (synthUnit) {
-                MusicDeviceMIDIEvent(synthUnit, 0xB0 | ch, 123, 0, 0);
-            }
+            internal_midi_event(0xB0 | ch, 123, 0);
         } else {
             send_midi_to_output(0xB0 | ch, 123, 0);
         }
@@ -755,12 +3967,22 @@ static void start_recording_on_beat(void) {
     recordStartBeat = currentBeat;
     beatsRecorded = 0;
 
-    // New events are appended to existing track data (overdub mode)
+    // Overdub passes become takes layered over the track; replace and punch
+    // overwrite the track's own notes
+    if (recordMode != RECORD_OVERDUB) take_begin(currentChannel);
+    else overdubBase = tracks[currentChannel].noteCount;
     update_status_display();
 }
 
 static void stop_recording(void) {
     if (!recording && !recordArmed) return;
+    if (recording) {
+        close_open_notes();
+        take_end();
+        take_store();
+        recording = false;
+        undo_commit(currentChannel);
+    }
     recording = false;
     recordArmed = false;
     update_status_display();
@@ -777,27 +3999,160 @@ static void sync_recording_to_capslock(void) {
 }
 
 // Tempo functions
-static void tempo_change(int bpm) {
-    if (recording) return;  // Can't change during recording
-    if (bpm < 20) bpm = 20;
-    if (bpm > 300) bpm = 300;
-    metronomeBPM = bpm;
+static int clamp_bpm(int bpm) {
+    if (bpm < MIN_BPM) return MIN_BPM;
+    if (bpm > MAX_BPM) return MAX_BPM;
+    return bpm;
+}
+
+// Rebuild the tempo map after a tempo or loop change, keeping the playhead at tick
+static void retime_transport(uint32_t tick) {
     update_timing_constants();
-    // Restart playback timer with new tempo-optimized interval
-    if (clockRunning && playbackTimer) {
-        start_playback_timer();
+
+    if (clockRunning) {
+        // Re-anchor the loop so the current tick is unchanged, then reschedule the next beat
+        if (tick >= totalLoopTicks) tick %= totalLoopTicks;
+        loopStartTime = mach_absolute_time() - tempo_tick_to_mach(tick);
+        loopStartFrac = 0;
+        sync_track_cursors(loopCount * totalLoopTicks + tick);
+        currentBeat = (int)(tick / TICKS_PER_BEAT) + 1;
+        if (currentBeat >= totalBeats) currentBeat = 0;
+        schedule_next_beat();
+        // Restart playback timer with new tempo-optimized interval
+        if (playbackTimer) start_playback_timer();
+    }
+    update_status_display();
+}
+
+// Send each track's program and mix (program state is chased on locate)
+static void send_track_programs(void) {
+    for (int t = 0; t < MIDI_TRACKS; t++) {
+        if (selectedOutput == 0) {
+            internal_midi_event(0xC0 | t, tracks[t].program, 0);
+        } else {
+            send_midi_to_output(0xC0 | t, tracks[t].program, 0);
+        }
+        send_track_mix(t);
+    }
+}
+
+// Locate - place the playhead at a bar-aligned tick whose downbeat grid is
+// anchored at the mach time 'anchor'. A new pass (newPass) keeps song ticks
+// monotonic for playback. Each track is positioned by binary search and its
+// sustained notes chased, so the cost does not depend on how far we jump.
+// The caller fires the beat at the anchor (beat_tick).
+static void relocate_transport(uint32_t tick, uint64_t anchor, bool newPass) {
+    if (tick >= totalLoopTicks) tick %= totalLoopTicks;
+    release_playing_notes();
+
+    loopStartTime = anchor - tempo_tick_to_mach(tick);
+    loopStartFrac = 0;
+    if (newPass) loopCount++;
+    nextLoopStartTime = loopStartTime;
+    nextLoopStartFrac = 0;
+    nextLoopCount = loopCount;
+    currentBeat = (int)(tick / TICKS_PER_BEAT);
+
+    uint64_t songTick = loopCount * totalLoopTicks + tick;
+    take_flush();  // A take continues from the new position (loop region wrap)
+    send_track_programs();
+    for (int t = 0; t < MIDI_TRACKS; t++) {
+        chase_track(t, (uint32_t)(songTick % track_loop_ticks(&tracks[t])));
+    }
+    if (takeChannel >= 0) {
+        takeStartTick = tracks[takeChannel].playPos;
+        takeCovered = 0;
+    }
+    lastSongTick = songTick;
+}
+
+static bool region_active(void) {
+    return regionEnabled && regionStartBar < regionEndBar && regionEndBar <= loopBars &&
+           !(regionStartBar == 0 && regionEndBar == loopBars);
+}
+
+static int current_bar(void) {
+    if (!clockRunning) return locateBar;
+    return (int)(get_current_tick() / ((uint32_t)beatsPerBar * TICKS_PER_BEAT));
+}
+
+// Locate to a bar: immediately while running, otherwise where the clock will start
+static void locate_bar(int bar) {
+    if (recording) return;
+    if (bar < 0 || bar >= loopBars) return;
+    locateBar = bar;
+    if (clockRunning) {
+        uint64_t anchor = mach_absolute_time();
+        relocate_transport((uint32_t)(bar * beatsPerBar * TICKS_PER_BEAT), anchor, true);
+        nextBeatMachTime = anchor;
+        beat_tick(NULL, NULL);  // Downbeat of the new bar now
+    } else {
+        update_status_display();
+    }
+}
+
+static void locate_home(void) {
+    locate_bar(region_active() ? regionStartBar : 0);
+}
+
+// Loop region A-B in bars: A at the current bar, B at the end of the current bar
+static void set_region_start(void) {
+    regionStartBar = current_bar();
+    if (regionEndBar <= regionStartBar) regionEndBar = regionStartBar + 1;
+    update_status_display();
+}
+
+static void set_region_end(void) {
+    regionEndBar = current_bar() + 1;
+    if (regionStartBar >= regionEndBar) regionStartBar = regionEndBar - 1;
+    update_status_display();
+}
+
+static void cycle_record_mode(void) {
+    if (recording || recordArmed) return;
+    recordMode = (RecordMode)((recordMode + 1) % RECORD_MODE_COUNT);
+    update_status_display();
+}
+
+static void toggle_region(void) {
+    regionEnabled = !regionEnabled;
+    if (regionEnabled && regionEndBar <= regionStartBar) {
+        regionStartBar = current_bar();
+        regionEndBar = regionStartBar + 1;
     }
     update_status_display();
 }
 
+static void apply_tempo_map(int startBPM, int endBPM) {
+    uint32_t tick = get_current_tick();
+    metronomeBPM = startBPM;
+    tempoEndBPM = endBPM;
+    retime_transport(tick);
+}
+
+// Shift the whole map (constant tempo or ramp keeps its shape)
+static void tempo_change(int bpm) {
+    if (recording) return;  // Can't change during recording
+    int delta = clamp_bpm(bpm) - metronomeBPM;
+    apply_tempo_map(metronomeBPM + delta, clamp_bpm(tempoEndBPM + delta));
+}
+
+// Change only the loop-end tempo (linear ramp from metronomeBPM)
+static void tempo_ramp_change(int bpm) {
+    if (recording) return;
+    apply_tempo_map(metronomeBPM, clamp_bpm(bpm));
+}
+
 static void tempo_change_timer_callback(CFRunLoopTimerRef timer, void *info) {
-    tempo_change(metronomeBPM + tempoChangeDirection);
+    if (tempoChangeRamp) tempo_ramp_change(tempoEndBPM + tempoChangeDirection);
+    else tempo_change(metronomeBPM + tempoChangeDirection);
 }
 
-static void start_tempo_change_timer(int direction) {
+static void start_tempo_change_timer(int direction, bool ramp) {
     if (recording) return;
     tempoChangeDirection = direction;
-    tempo_change(metronomeBPM + direction);
+    tempoChangeRamp = ramp;
+    tempo_change_timer_callback(NULL, NULL);
 
     if (tempoChangeTimer) {
         CFRunLoopTimerInvalidate(tempoChangeTimer);
@@ -821,6 +4176,39 @@ static void stop_tempo_change_timer(void) {
     }
 }
 
+// Loop length and meter - session parameters, changeable while playing (not recording).
+// Events past a shortened loop are kept but not played or saved.
+static void set_loop_length(int bars, int beats) {
+    if (recording) return;  // Can't change during recording
+    if (bars < 1 || bars > MAX_LOOP_BARS) return;
+    if (beats < MIN_BEATS_PER_BAR || beats > MAX_BEATS_PER_BAR) return;
+
+    uint32_t tick = get_current_tick();
+    loopBars = bars;
+    beatsPerBar = beats;
+    totalBeats = bars * beats;
+    totalLoopTicks = (uint32_t)totalBeats * TICKS_PER_BEAT;
+    for (int t = 0; t < MIDI_TRACKS; t++) tracks[t].dirty = true;  // Loop end and bar lines moved
+    retime_transport(tick);
+}
+
+// Current track's own loop length (0 = follow session loop)
+static void set_track_loop_bars(int bars) {
+    if (recording) return;
+    if (bars < 0 || bars > MAX_LOOP_BARS) return;
+    MIDITrack *track = &tracks[currentChannel];
+    track->loopBars = bars;
+    track->playPos = (uint32_t)(get_song_tick() % track_loop_ticks(track));
+    track->dirty = true;
+    undo_commit(currentChannel);
+    update_status_display();
+}
+
+static void cycle_time_signature(void) {
+    int beats = (beatsPerBar < MAX_BEATS_PER_BAR) ? beatsPerBar + 1 : MIN_BEATS_PER_BAR;
+    set_loop_length(loopBars, beats);
+}
+
 // Program change with auto-repeat
 static void program_change_timer_callback(CFRunLoopTimerRef timer, void *info) {
     int newProgram = (tracks[currentChannel].program + programChangeDirection + 128) % 128;
@@ -876,26 +4264,57 @@ static void toggle_metronome(void) {
     update_status_display();
 }
 
-// Quantize all tracks to 16th note grid
-static void quantize_all_tracks(void) {
+// Quantize settings for the current track. Only that track is marked dirty,
+// so its playback index alone is rebuilt on the next playback tick.
+static void cycle_quantize_grid(void) {
+    MIDITrack *track = &tracks[currentChannel];
+    track->quantizeGrid = (track->quantizeGrid + 1) % QUANTIZE_GRID_COUNT;
+    track->dirty = true;
+    undo_commit(currentChannel);
+    update_status_display();
+}
+
+static void cycle_quantize_swing(void) {
+    MIDITrack *track = &tracks[currentChannel];
+    track->quantizeSwing = (track->quantizeSwing + 1) % QUANTIZE_SWING_COUNT;
+    track->dirty = true;
+    undo_commit(currentChannel);
+    update_status_display();
+}
+
+static void cycle_quantize_strength(void) {
+    MIDITrack *track = &tracks[currentChannel];
+    track->quantizeStrength = (track->quantizeStrength + 1) % QUANTIZE_STRENGTH_COUNT;
+    track->dirty = true;
+    undo_commit(currentChannel);
+    update_status_display();
+}
+
+// Extract the groove from the current track; tracks quantized to it are rebuilt
+static void extract_groove(void) {
+    if (tracks[currentChannel].noteCount == 0) return;
+    groove_extract(&tracks[currentChannel], &groove);
     for (int t = 0; t < MIDI_TRACKS; t++) {
-        MIDITrack *track = &tracks[t];
-        for (int i = 0; i < track->eventCount; i++) {
-            uint32_t tick = track->events[i].tick;
-            // Round to nearest 16th note
-            uint32_t quantized = ((tick + TICKS_PER_16TH / 2) / TICKS_PER_16TH) * TICKS_PER_16TH;
-            // Wrap if quantized past loop end
-            track->events[i].tick = quantized % totalLoopTicks;
-        }
+        if (tracks[t].quantizeGrid == QUANTIZE_GRID_GROOVE) tracks[t].dirty = true;
     }
+    printf("\r\033[KGroove extracted from track %d (%d slots)", currentChannel + 1, groove.slots);
+    fflush(stdout);
 }
 
-// Toggle quantize
-static void toggle_quantize(void) {
-    quantizeEnabled = !quantizeEnabled;
-    if (quantizeEnabled) {
-        quantize_all_tracks();
-    }
+// Playback transpose and velocity scale for the current track (non-destructive)
+static void set_track_transpose(int semitones) {
+    if (semitones < -24 || semitones > 24) return;
+    tracks[currentChannel].transpose = (int8_t)semitones;
+    tracks[currentChannel].dirty = true;
+    undo_commit(currentChannel);
+    update_status_display();
+}
+
+static void set_track_velocity_trim(int trim) {
+    if (trim < -6 || trim > 8) return;
+    tracks[currentChannel].velocityTrim = (int8_t)trim;
+    tracks[currentChannel].dirty = true;
+    undo_commit(currentChannel);
     update_status_display();
 }
 
@@ -927,15 +4346,6 @@ static void write_big_endian_32(FILE *f, uint32_t value) {
     fputc(value & 0xFF, f);
 }
 
-// Compare function for sorting events
-static int compare_events(const void *a, const void *b) {
-    const MIDIEvent *ea = (const MIDIEvent *)a;
-    const MIDIEvent *eb = (const MIDIEvent *)b;
-    if (ea->tick < eb->tick) return -1;
-    if (ea->tick > eb->tick) return 1;
-    return 0;
-}
-
 static void save_midi_file(void) {
     time_t now = time(NULL);
     struct tm *gmt = gmtime(&now);
@@ -949,9 +4359,12 @@ static void save_midi_file(void) {
         return;
     }
 
-    // Count tracks with events
+    long bytesSaved = 0;  // Status bytes elided by running status
+
+    // Build every track's events first so empty tracks are known
     int trackCount = 1;  // Tempo track
     for (int i = 0; i < MIDI_TRACKS; i++) {
+        track_prepare(&tracks[i]);
         if (tracks[i].eventCount > 0) trackCount++;
     }
 
@@ -969,26 +4382,33 @@ static void save_midi_file(void) {
 
     long trackStart = ftell(f);
 
-    // Tempo meta event
-    write_variable_length(f, 0);  // Delta time
-    fputc(0xFF, f);               // Meta event
-    fputc(0x51, f);               // Tempo
-    fputc(0x03, f);               // Length
-    uint32_t microsPerBeat = 60000000 / metronomeBPM;
-    fputc((microsPerBeat >> 16) & 0xFF, f);
-    fputc((microsPerBeat >> 8) & 0xFF, f);
-    fputc(microsPerBeat & 0xFF, f);
-
     // Time signature
     write_variable_length(f, 0);
     fputc(0xFF, f);
     fputc(0x58, f);
     fputc(0x04, f);
-    fputc(BEATS_PER_BAR, f);  // Numerator
+    fputc(beatsPerBar, f);    // Numerator
     fputc(2, f);               // Denominator (2 = quarter note)
     fputc(24, f);              // MIDI clocks per metronome click
     fputc(8, f);               // 32nd notes per quarter
 
+    // Tempo map - one tempo meta event per table node (ramps written as steps)
+    uint32_t lastTempoTick = 0;
+    uint32_t lastMicrosPerBeat = 0;
+    for (int i = 0; i < tempoNodeCount; i++) {
+        uint32_t microsPerBeat = tempoNodes[i].microsPerBeat;
+        if (microsPerBeat == lastMicrosPerBeat) continue;
+        write_variable_length(f, tempoNodes[i].tick - lastTempoTick);  // Delta time
+        fputc(0xFF, f);               // Meta event
+        fputc(0x51, f);               // Tempo
+        fputc(0x03, f);               // Length
+        fputc((microsPerBeat >> 16) & 0xFF, f);
+        fputc((microsPerBeat >> 8) & 0xFF, f);
+        fputc(microsPerBeat & 0xFF, f);
+        lastTempoTick = tempoNodes[i].tick;
+        lastMicrosPerBeat = microsPerBeat;
+    }
+
     // End of track
     write_variable_length(f, 0);
     fputc(0xFF, f);
@@ -1006,30 +4426,76 @@ static void save_midi_file(void) {
         MIDITrack *track = &tracks[t];
         if (track->eventCount == 0) continue;
 
-        // Sort events by tick
-        qsort(track->events, track->eventCount, sizeof(MIDIEvent), compare_events);
-
         fwrite("MTrk", 1, 4, f);
         trackLenPos = ftell(f);
         write_big_endian_32(f, 0);  // Placeholder
         trackStart = ftell(f);
 
-        // Program change
+        // Program change and mix (mute and solo only affect monitoring)
         write_variable_length(f, 0);
         fputc(0xC0 | t, f);
         fputc(track->program, f);
-
-        // Write events
+        write_variable_length(f, 0);
+        fputc(0xB0 | t, f);
+        fputc(7, f);
+        fputc(track->volume, f);
+        write_variable_length(f, 0);
+        fputc(10, f);
+        fputc(track->pan, f);
+        uint8_t runningStatus = 0xB0 | t;
+
+        // Write events - a track shorter than the session loop is repeated to fill it.
+        // A note crossing the loop end has its note-off wrapped to the start, so
+        // in the file it closes the note from the previous repeat: the first
+        // repeat's wrapped note-offs have nothing to close and are skipped, and
+        // notes still sounding at the end of the span are closed there.
+        uint32_t len = track_loop_ticks(track);
+        uint32_t span = (len < totalLoopTicks) ? totalLoopTicks : len;
         uint32_t lastTick = 0;
-        for (int i = 0; i < track->eventCount; i++) {
-            MIDIEvent *ev = &track->events[i];
-            uint32_t delta = ev->tick - lastTick;
-            lastTick = ev->tick;
-
-            write_variable_length(f, delta);
-            fputc(ev->status | t, f);
-            fputc(ev->note, f);
-            fputc(ev->velocity, f);
+        uint8_t sounding[128] = {0};
+        for (uint32_t offset = 0; offset < span; offset += len) {
+            for (int i = 0; i < track->eventCount; i++) {
+                MIDIEvent *ev = &track->events[i];
+                uint32_t tick = offset + ev->tick;
+                if (tick >= span) break;
+                if (ev->status == 0x80) {
+                    if (sounding[ev->note] == 0) continue;
+                    sounding[ev->note]--;
+                } else {
+                    sounding[ev->note]++;
+                }
+                uint32_t delta = tick - lastTick;
+                lastTick = tick;
+
+                write_variable_length(f, delta);
+
+                // Note-offs are written as note-on velocity 0 so the whole track
+                // shares one running status and each event is two bytes
+                uint8_t velocity = (ev->status == 0x80) ? 0 : ev->velocity;
+                uint8_t status = 0x90 | t;
+                if (status != runningStatus) {
+                    fputc(status, f);
+                    runningStatus = status;
+                } else {
+                    bytesSaved++;
+                }
+                fputc(ev->note, f);
+                fputc(velocity, f);
+            }
+        }
+        for (int n = 0; n < 128; n++) {
+            for (; sounding[n]; sounding[n]--) {
+                write_variable_length(f, span - lastTick);
+                lastTick = span;
+                if (runningStatus != (0x90 | t)) {
+                    runningStatus = 0x90 | t;
+                    fputc(runningStatus, f);
+                } else {
+                    bytesSaved++;
+                }
+                fputc(n, f);
+                fputc(0, f);
+            }
         }
 
         // End of track
@@ -1045,22 +4511,23 @@ static void save_midi_file(void) {
         fseek(f, trackEnd, SEEK_SET);
     }
 
+    long fileSize = ftell(f);
     fclose(f);
-    printf("\r\033[KSaved: %s", filename);
+    printf("\r\033[KSaved: %s (%ld bytes, %ld saved by running status)", filename, fileSize, bytesSaved);
     fflush(stdout);
 }
 
 // Status display
 static void update_status_display(void) {
-    int bar = currentBeat / BEATS_PER_BAR + 1;
-    int beatInBar = currentBeat % BEATS_PER_BAR + 1;
+    int bar = currentBeat / beatsPerBar + 1;
+    int beatInBar = currentBeat % beatsPerBar + 1;
 
     printf("\r\033[K");
 
     // Transport status
     if (clockRunning) {
         if (recording) {
-            printf("\033[31m[REC %d/%d]\033[0m ", beatsRecorded, TOTAL_BEATS);
+            printf("\033[31m[REC %d/%d]\033[0m ", beatsRecorded, track_loop_beats(&tracks[currentChannel]));
         } else if (recordArmed) {
             printf("\033[33m[ARM]\033[0m ");
         } else {
@@ -1069,12 +4536,28 @@ static void update_status_display(void) {
         printf("%d.%d ", bar, beatInBar);
     } else {
         printf("[STOP] ");
+        if (locateBar) printf("@%d ", locateBar + 1);
     }
 
     // Tempo, metronome, and quantize
-    printf("%3dBPM ", metronomeBPM);
+    if (tempoEndBPM != metronomeBPM) {
+        printf("%3d>%dBPM ", metronomeBPM, tempoEndBPM);
+    } else {
+        printf("%3dBPM ", metronomeBPM);
+    }
     printf("%s ", metronomeEnabled ? "M" : "-");
-    printf("%s ", quantizeEnabled ? "Q" : "-");
+    if (recordMode != RECORD_OVERDUB) printf("%s ", recordModeNames[recordMode]);
+    MIDITrack *track = &tracks[currentChannel];
+    printf("Q%s", quantizeGridNames[track->quantizeGrid]);
+    if (track->quantizeGrid) {
+        if (track->quantizeSwing && track->quantizeGrid != QUANTIZE_GRID_GROOVE) {
+            printf(" S%d", quantizeSwingPercent[track->quantizeSwing]);
+        }
+        if (track->quantizeStrength) printf(" %d%%", quantizeStrengthPercent[track->quantizeStrength]);
+    }
+    printf(" ");
+    printf("%d/4x%d ", beatsPerBar, loopBars);
+    if (regionEnabled) printf("A%d-%d%s ", regionStartBar + 1, regionEndBar, region_active() ? "" : "?");
 
     // Channel and octave
     printf("Ch%2d Oct%d ", currentChannel + 1, currentOctave);
@@ -1085,12 +4568,41 @@ static void update_status_display(void) {
     progName[19] = '\0';
     printf("P%03d:%.19s ", tracks[currentChannel].program, progName);
 
-    // Event count for current track
-    printf("[%d] ", tracks[currentChannel].eventCount);
+    // Event count for current track and its takes (with the current bar's comp,
+    // if not every take), then its own loop length, if set
+    printf("[%d", track->noteCount);
+    if (track->takeCount) {
+        uint16_t mask = track->compMask[track_current_bar(track)];
+        printf(" +%dtk", track->takeCount);
+        if (mask != (1u << track->takeCount) - 1) {
+            printf(":");
+            for (int k = 0; k < track->takeCount; k++) {
+                if (mask & (1u << k)) printf("%d", k + 1);
+            }
+        }
+    }
+    printf("] ");
+    if (tracks[currentChannel].loopBars) printf("L%d ", tracks[currentChannel].loopBars);
+    if (tracks[currentChannel].transpose) printf("T%+d ", tracks[currentChannel].transpose);
+    if (tracks[currentChannel].velocityTrim) printf("V%d%% ", 100 + 100 * tracks[currentChannel].velocityTrim / 8);
+    if (track->volume != 100) printf("Vol%d ", track->volume);
+    if (track->pan != 64) printf("Pan%c%d ", track->pan < 64 ? 'L' : 'R', abs(track->pan - 64));
+    if (track->mute) printf("\033[33mMUTE\033[0m ");
+    if (track->solo) printf("\033[33mSOLO\033[0m ");
 
     // MIDI Output
     if (selectedOutput == 0) {
-        printf("Out:Internal");
+        printf("Out:Internal%s", nativeSynth ? ":Native" : "");
+        if (nativeSynth) {
+            // Strip peak meters, one glyph per channel in 6 dB steps
+            static const char *levels[9] = { " ", "▁", "▂", "▃", "▄", "▅", "▆", "▇", "█" };
+            printf(" ");
+            for (int c = 0; c < MIDI_TRACKS; c++) {
+                float peak = atomic_load_explicit(&synthMeters[c], memory_order_relaxed);
+                int level = peak > 0.0f ? (int)((20.0f * log10f(peak) + 54.0f) / 6.0f) : 0;
+                printf("%s", levels[level < 0 ? 0 : level > 8 ? 8 : level]);
+            }
+        }
     } else if (selectedOutput <= midiDestCount) {
         printf("Out:%d:%.16s", selectedOutput, midiDestNames[selectedOutput - 1]);
     }
@@ -1127,8 +4639,19 @@ static bool should_consume_key(CGKeyCode keycode) {
     if (keycode == RBRACKET_KEYCODE) return true;
     if (keycode == SLASH_KEYCODE) return true;
     if (keycode == DELETE_KEYCODE) return true;
+    if (keycode == RETURN_KEYCODE) return true;
+    if (keycode == F1_KEYCODE || keycode == F2_KEYCODE || keycode == F3_KEYCODE) return true;
+    if (keycode == F4_KEYCODE || keycode == F5_KEYCODE || keycode == F6_KEYCODE) return true;
     if (keycode == BACKTICK_KEYCODE) return true;
     if (keycode == BACKSLASH_KEYCODE) return true;
+    if (keycode == SEMICOLON_KEYCODE) return true;
+    if (keycode == COMMA_KEYCODE) return true;
+    if (keycode == PERIOD_KEYCODE) return true;
+    if (keycode == QUOTE_KEYCODE) return true;
+    if (keycode == HOME_KEYCODE) return true;
+    if (keycode == END_KEYCODE) return true;
+    if (keycode == PAGE_UP_KEYCODE) return true;
+    if (keycode == PAGE_DOWN_KEYCODE) return true;
 
     // Number keys
     if (keycode == KEY_0_KEYCODE) return true;
@@ -1211,7 +4734,8 @@ static CGEventRef event_tap_callback(CGEventTapProxy proxy, CGEventType type, CG
 
     // TAB - Toggle metronome
     if (keycode == TAB_KEYCODE && pressed) {
-        toggle_metronome();
+        if (flags & kCGEventFlagMaskShift) cycle_record_mode();
+        else toggle_metronome();
         return NULL;
     }
 
@@ -1225,29 +4749,112 @@ static CGEventRef event_tap_callback(CGEventTapProxy proxy, CGEventType type, CG
         return NULL;
     }
     if (keycode == UP_ARROW_KEYCODE) {
-        if (pressed) start_tempo_change_timer(1);
+        if (pressed) start_tempo_change_timer(1, (flags & kCGEventFlagMaskShift) != 0);
         else if (isKeyUp) stop_tempo_change_timer();
         return NULL;
     }
     if (keycode == DOWN_ARROW_KEYCODE) {
-        if (pressed) start_tempo_change_timer(-1);
+        if (pressed) start_tempo_change_timer(-1, (flags & kCGEventFlagMaskShift) != 0);
         else if (isKeyUp) stop_tempo_change_timer();
         return NULL;
     }
 
-    // MINUS - Channel down
+    // MINUS - Channel down (with SHIFT: transpose current track down)
     if (keycode == MINUS_KEYCODE && pressed) {
-        channel_change((currentChannel - 1 + 16) % 16);
+        if (flags & kCGEventFlagMaskShift) set_track_transpose(tracks[currentChannel].transpose - 1);
+        else channel_change((currentChannel - 1 + 16) % 16);
         return NULL;
     }
 
-    // EQUALS - Channel up
+    // EQUALS - Channel up (with SHIFT: transpose current track up)
     if (keycode == EQUALS_KEYCODE && pressed) {
-        channel_change((currentChannel + 1) % 16);
+        if (flags & kCGEventFlagMaskShift) set_track_transpose(tracks[currentChannel].transpose + 1);
+        else channel_change((currentChannel + 1) % 16);
+        return NULL;
+    }
+
+    // COMMA / PERIOD - Loop length down/up (with SHIFT: current track's own loop)
+    if (keycode == COMMA_KEYCODE && pressed) {
+        if (flags & kCGEventFlagMaskShift) set_track_loop_bars(tracks[currentChannel].loopBars - 1);
+        else set_loop_length(loopBars - 1, beatsPerBar);
+        return NULL;
+    }
+    if (keycode == PERIOD_KEYCODE && pressed) {
+        if (flags & kCGEventFlagMaskShift) set_track_loop_bars(tracks[currentChannel].loopBars + 1);
+        else set_loop_length(loopBars + 1, beatsPerBar);
+        return NULL;
+    }
+
+    // QUOTE - Commit retrospective capture to current track
+    if (keycode == QUOTE_KEYCODE && pressed) {
+        if (flags & kCGEventFlagMaskShift) extract_groove();
+        else capture_commit();
+        return NULL;
+    }
+
+    // F1-F6 - Current track mix: volume, pan, mute, solo
+    if (keycode == F1_KEYCODE && pressed) {
+        set_track_volume(tracks[currentChannel].volume - 8);
+        return NULL;
+    }
+    if (keycode == F2_KEYCODE && pressed) {
+        set_track_volume(tracks[currentChannel].volume + 8);
+        return NULL;
+    }
+    if (keycode == F3_KEYCODE && pressed) {
+        set_track_pan(tracks[currentChannel].pan - 8);
+        return NULL;
+    }
+    if (keycode == F4_KEYCODE && pressed) {
+        set_track_pan(tracks[currentChannel].pan + 8);
+        return NULL;
+    }
+    if (keycode == F5_KEYCODE && pressed) {
+        toggle_track_mute();
+        return NULL;
+    }
+    if (keycode == F6_KEYCODE && pressed) {
+        toggle_track_solo();
+        return NULL;
+    }
+
+    // HOME / END - Locate to region start (or bar 1), toggle loop region
+    if (keycode == HOME_KEYCODE && pressed) {
+        locate_home();
+        return NULL;
+    }
+    if (keycode == END_KEYCODE && pressed) {
+        toggle_region();
+        return NULL;
+    }
+
+    // PAGE UP / DOWN - Locate one bar back/forward (with SHIFT: set region A / B)
+    if (keycode == PAGE_UP_KEYCODE && pressed) {
+        if (flags & kCGEventFlagMaskShift) set_region_start();
+        else locate_bar(current_bar() - 1);
+        return NULL;
+    }
+    if (keycode == PAGE_DOWN_KEYCODE && pressed) {
+        if (flags & kCGEventFlagMaskShift) set_region_end();
+        else locate_bar(current_bar() + 1);
         return NULL;
     }
 
-    // Brackets - Program change
+    // SEMICOLON - Cycle time signature
+    if (keycode == SEMICOLON_KEYCODE && pressed) {
+        cycle_time_signature();
+        return NULL;
+    }
+
+    // Brackets - Program change (with SHIFT: current track velocity scale)
+    if (keycode == LBRACKET_KEYCODE && pressed && (flags & kCGEventFlagMaskShift)) {
+        set_track_velocity_trim(tracks[currentChannel].velocityTrim - 1);
+        return NULL;
+    }
+    if (keycode == RBRACKET_KEYCODE && pressed && (flags & kCGEventFlagMaskShift)) {
+        set_track_velocity_trim(tracks[currentChannel].velocityTrim + 1);
+        return NULL;
+    }
     if (keycode == LBRACKET_KEYCODE) {
         if (pressed) start_program_change_timer(-1);
         else if (isKeyUp) stop_program_change_timer();
@@ -1271,20 +4878,45 @@ static CGEventRef event_tap_callback(CGEventTapProxy proxy, CGEventType type, CG
         return NULL;
     }
 
-    // BACKTICK - Toggle quantize
+    // RETURN - Undo (Shift: redo)
+    if (keycode == RETURN_KEYCODE && pressed) {
+        undo_step(flags & kCGEventFlagMaskShift);
+        return NULL;
+    }
+
+    // BACKTICK - Cycle quantize grid (Shift: swing)
     if (keycode == BACKTICK_KEYCODE && pressed) {
-        toggle_quantize();
+        if (flags & kCGEventFlagMaskShift) cycle_quantize_swing();
+        else cycle_quantize_grid();
         return NULL;
     }
 
-    // BACKSLASH - Panic (all notes off on all channels)
+    // BACKSLASH - Panic (all notes off on all channels; Shift: quantize strength)
     if (keycode == BACKSLASH_KEYCODE && pressed) {
-        midi_panic();
+        if (flags & kCGEventFlagMaskShift) cycle_quantize_strength();
+        else midi_panic();
         return NULL;
     }
 
+    // SHIFT+0-9 - Comp takes in the current bar (1-9 = only that take, 0 = all)
+    if (flags & kCGEventFlagMaskShift) {
+        const uint16_t takeKeys[10] = {
+            KEY_0_KEYCODE, KEY_1_KEYCODE, KEY_2_KEYCODE, KEY_3_KEYCODE, KEY_4_KEYCODE,
+            KEY_5_KEYCODE, KEY_6_KEYCODE, KEY_7_KEYCODE, KEY_8_KEYCODE, KEY_9_KEYCODE
+        };
+        for (int k = 0; k < 10; k++) {
+            if (keycode != takeKeys[k]) continue;
+            if (pressed) comp_take(k);
+            return NULL;
+        }
+    }
+
     // Number keys 0-9 - Select MIDI output
-    if (keycode == KEY_0_KEYCODE && pressed) { select_midi_output(0); return NULL; }
+    if (keycode == KEY_0_KEYCODE && pressed) {
+        if (selectedOutput == 0) toggle_native_synth();  // Again: switch synth engine
+        else select_midi_output(0);
+        return NULL;
+    }
     if (keycode == KEY_1_KEYCODE && pressed) { select_midi_output(1); return NULL; }
     if (keycode == KEY_2_KEYCODE && pressed) { select_midi_output(2); return NULL; }
     if (keycode == KEY_3_KEYCODE && pressed) { select_midi_output(3); return NULL; }
@@ -1342,7 +4974,15 @@ static bool init_event_tap(void) {
 int main(void) {
     // Initialize arrays
     memset(heldNoteChannel, -1, sizeof(heldNoteChannel));
+    memset(openNote, -1, sizeof(openNote));
+    memset(voiceMap, -1, sizeof(voiceMap));
+    fx_init();
     memset(tracks, 0, sizeof(tracks));
+    for (int t = 0; t < MIDI_TRACKS; t++) {
+        tracks[t].volume = 100;
+        tracks[t].pan = 64;
+    }
+    undo_init();
 
     init_timing();
     update_timing_constants();
@@ -1353,19 +4993,49 @@ int main(void) {
     printf("Notes:     z-m, a-l, q-p (3 rows)\n");
     printf("SPACE      Start/Stop clock\n");
     printf("CAPSLOCK   Record (while clock running)\n");
-    printf("TAB        Toggle metronome\n");
-    printf("`          Toggle quantize (16th notes)\n");
+    printf("TAB        Toggle metronome (Shift: record mode OVR/RPL/PCH)\n");
+    printf("`          Cycle quantize grid (Shift: swing)\n");
     printf("←/→        Octave down/up\n");
     printf("↑/↓        Tempo up/down (hold)\n");
-    printf("-/=        Channel down/up\n");
-    printf("[/]        Program down/up (hold)\n");
-    printf("0-9        Select MIDI output\n");
+    printf("SHIFT+↑/↓  Loop-end tempo (ramp) up/down (hold)\n");
+    printf("-/=        Channel down/up (Shift: transpose track)\n");
+    printf(",/.        Loop length down/up (bars)\n");
+    printf(";          Cycle time signature\n");
+    printf("SHIFT+,/.  Track loop length down/up (0 = follow loop)\n");
+    printf("'          Capture last 30s of playing into current track\n");
+    printf("SHIFT+'    Extract groove from current track (quantize grid GRV)\n");
+    printf("HOME/END   Locate to region start / toggle loop region\n");
+    printf("PGUP/PGDN  Locate bar back/forward (Shift: set region A/B)\n");
+    printf("[/]        Program down/up (hold; Shift: track velocity)\n");
+    printf("0-9        Select MIDI output (0 again: DLS / native synth)\n");
+    printf("SHIFT+1-9  Comp: play only that take in this bar (SHIFT+0: all takes)\n");
+    printf("F1/F2      Track volume down/up (CC7)\n");
+    printf("F3/F4      Track pan left/right (CC10)\n");
+    printf("F5/F6      Track mute / solo\n");
     printf("DELETE     Clear current track\n");
+    printf("RETURN     Undo (Shift: redo)\n");
     printf("/          Save MIDI file\n");
-    printf("\\          Panic (all notes off)\n");
+    printf("\\          Panic (all notes off; Shift: quantize strength)\n");
     printf("ESC        Quit\n");
     printf("══════════════════════════════════════════════════\n");
-    printf("Loop: %d bars x %d beats = %d beats total\n", TOTAL_BARS, BEATS_PER_BAR, TOTAL_BEATS);
+    printf("Loop: %d bars x %d beats = %d beats total\n", loopBars, beatsPerBar, totalBeats);
+
+    // Optional SoundFont for the native engine (mapped, not read)
+    const char *sf2Path = getenv(SF2_ENV);
+    if (sf2Path) {
+        if (sf2_load(sf2Path)) {
+            printf("SoundFont: %s (%u zones)\n", sf2Path, sf2ZoneCount);
+        } else {
+            fprintf(stderr, "Warning: Could not load SoundFont %s\n", sf2Path);
+        }
+    }
+
+    const char *drumDir = getenv(DRUM_WAV_ENV);
+    if (drumDir) {
+        printf("Drum samples: %s (%d notes)\n", drumDir, drum_samples_load(drumDir));
+    }
+    synthMachPerFrame = 1e9 / SYNTH_SAMPLE_RATE * timebaseInfo.denom / timebaseInfo.numer;
+    render_workers_start();
 
     if (!init_audio()) {
         fprintf(stderr, "Failed to initialize audio\n");
@@ -1414,6 +5084,11 @@ int main(void) {
         AUGraphStop(graph);
         DisposeAUGraph(graph);
     }
+    render_workers_stop();
+    sf2_unload();
+    for (int n = 0; n < 128; n++) {
+        if (drumSamples[n].map) munmap((void *)drumSamples[n].map, drumSamples[n].mapSize);
+    }
 
     return 0;
 }